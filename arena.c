@@ -0,0 +1,205 @@
+//
+//  arena.c
+//  minibox
+//
+//  Created by Antonio Angel Martínez Domínguez on 1/6/19.
+//
+//  Copyright 2019 Rokit Systems
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "box.h"
+
+#define ARENA_CHUNK 0x10000
+#define ARENA_ALIGN(s) (((s) + 0xF) & ~0xFL)
+#define ARENA_HEAD ARENA_ALIGN((long) sizeof(chunk_t))
+#define ARENA_LARGE(s) ((s) > BOXM / 4)
+#define ARENA_DATA(c) ((char *)(c) + ARENA_HEAD)
+
+/*
+ * Chunks are chained from the most recent one (BOXB). Small blocks are
+ * bumped out of the head chunk; large blocks get a chunk of their own
+ * so that growing box buffers can be handed back to realloc().
+ */
+typedef struct __chunk
+{
+    struct __chunk *next;
+    struct __chunk *prev;
+    long size;
+    long used;
+    long last;
+} chunk_t;
+
+static __thread box_t arena_active = 0;
+
+box_t new_arena(void)
+{
+    long *box;
+
+    if (!(box = malloc(BOX_HEADER)))
+    {
+        ERROR(BOX_MEMORY_ERROR, "new_arena()")
+        return 0;
+    }
+
+    box[0] = 0;
+    box[1] = 0;
+    box[2] = MINIBOX_TYPE_ARENA;
+    box[3] = ARENA_CHUNK;
+    box[4] = 0;
+    box[5] = 0;
+    box[6] = 0;
+
+    return (long) box;
+}
+
+box_t arena_use(box_t __box)
+{
+    box_t prev = arena_active;
+    arena_active = __box;
+    return prev;
+}
+
+box_t arena_current(void)
+{
+    return arena_active;
+}
+
+static chunk_t* arena_chunk(box_t __box, long __size)
+{
+    chunk_t *c, *head = BOXB;
+    int large = ARENA_LARGE(__size);
+    long size = large ? __size : BOXM;
+
+    if (!(c = malloc(ARENA_HEAD + size)))
+    {
+        ERROR(BOX_MEMORY_ERROR, "arena_chunk()")
+        return NULL;
+    }
+
+    c->size = size;
+    c->used = 0;
+    c->last = 0;
+
+    if (large && head)
+    {
+        c->prev = head;
+        c->next = head->next;
+        if (head->next) head->next->prev = c;
+        head->next = c;
+    }
+    else
+    {
+        c->prev = NULL;
+        c->next = head;
+        if (head) head->prev = c;
+        ((long *) __box)[0] = (long) c;
+    }
+
+    ((long *) __box)[1] += size;
+
+    return c;
+}
+
+void* arena_alloc(box_t __box, long __size)
+{
+    chunk_t *c;
+
+    if (!__box) return malloc(__size);
+
+    __size = ARENA_ALIGN(__size);
+    c = BOXB;
+
+    if (ARENA_LARGE(__size) || !c || c->used + __size > c->size)
+        if (!(c = arena_chunk(__box, __size)))
+            return NULL;
+
+    c->last = c->used;
+    c->used += __size;
+
+    return ARENA_DATA(c) + c->last;
+}
+
+void* arena_realloc(box_t __box, void *__ptr, long __old, long __size)
+{
+    chunk_t *c, *n;
+    void *tmp;
+
+    if (!__box) return realloc(__ptr, __size);
+
+    __old = ARENA_ALIGN(__old);
+    __size = ARENA_ALIGN(__size);
+
+    if (ARENA_LARGE(__old))
+    {
+        c = (chunk_t *) ((char *) __ptr - ARENA_HEAD);
+
+        if (!(n = realloc(c, ARENA_HEAD + __size)))
+            return NULL;
+
+        if (n->prev) n->prev->next = n; else ((long *) __box)[0] = (long) n;
+        if (n->next) n->next->prev = n;
+
+        ((long *) __box)[1] += __size - n->size;
+        n->size = n->used = __size;
+
+        return ARENA_DATA(n);
+    }
+
+    c = BOXB;
+
+    if (c && __ptr == ARENA_DATA(c) + c->last && c->last + __size <= c->size &&
+        !ARENA_LARGE(__size))
+    {
+        c->used = c->last + __size;
+        return __ptr;
+    }
+
+    if (!(tmp = arena_alloc(__box, __size)))
+        return NULL;
+
+    memcpy(tmp, __ptr, __old < __size ? __old : __size);
+
+    return tmp;
+}
+
+void arena_retain(box_t __box, box_t __heap)
+{
+    box_link(__heap, BOXL);
+    box_link(__box, __heap);
+}
+
+void arena_free(box_t __box, void *__ptr)
+{
+    if (!__box) free(__ptr);
+}
+
+void arena_release(box_t __box)
+{
+    chunk_t *c = BOXB, *n;
+
+    if (arena_active == __box)
+        arena_active = 0;
+
+    while (c)
+    {
+        n = c->next;
+        free(c);
+        c = n;
+    }
+
+    free((void *) __box);
+}
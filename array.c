@@ -19,11 +19,27 @@
 //  limitations under the License.
 //
 
+#include <string.h>
+#include <math.h>
 #include "box.h"
 
+/*
+ * Doubles are stored as they are, so an array holding nothing else is
+ * already a packed double[]. Integer literals are stored as INT48, so an
+ * array holding only those is the packed integer kind, reduced straight
+ * from its slots. BOXH counts the elements that are not doubles in its
+ * low half and those that are not INT48 in its high half; other arrays
+ * are converted on the way, a chunk at a time. Writes made through
+ * array_get() are not tracked.
+ */
+#define ARRAY_OTHER(v) (VALUE_TAGGED(v) + ((long) (VALUE_TYPE(v) != MINIBOX_INT48) << 32))
+#define ARRAY_PACKED(h) (!((h) & 0xFFFFFFFF))
+#define ARRAY_INT48(h) (!((h) >> 32))
+#define ARRAY_CHUNK 0x200
+
 #define arrset(p) \
-    box_set(__box, p + MINIBOX_VALUE, __value); \
-    box_set(__box, p + MINIBOX_TYPE , &__type)
+    SLOT(BOXB + p) = box_value(__box, __type, __value); \
+    BOXH += ARRAY_OTHER(SLOT(BOXB + p))
 
 box_t new_array()
 {
@@ -32,68 +48,107 @@ box_t new_array()
 
 void* array_get(box_t __box, long __index)
 {
-    return BOXB + (__index * V2S);
+    BOX_LOAD(__box);
+    
+    return BOXB + (__index * V1S);
 }
 
 void array_remove(box_t __box, long __index)
 {
-    long p = __index * V2S;
+    long p = __index * V1S;
+    
+    BOX_LOAD(__box);
     
-    box_free_value(BOXB + p);
+    BOXH -= ARRAY_OTHER(SLOT(BOXB + p));
+    box_free_value(__box, BOXB + p);
     
-    if (box_move(__box, p + V2S, p, (BOXS - V2S) - p))
+    if (box_move(__box, p + V1S, p, (BOXS - V1S) - p))
         return;
     
-    if (box_reallocated(__box, -V2S)) return;
+    if (box_reallocated(__box, -V1S)) return;
 }
 
 long array_count(box_t __box)
 {
-    return BOXS / V2S;
+    BOX_LOAD(__box);
+    
+    return BOXS / V1S;
+}
+
+/*
+ * Moves every value of __from to the end of __box, leaving __from empty
+ * so that freeing it releases nothing it held.
+ */
+int array_take(box_t __box, box_t __from)
+{
+    long *from = (long *) __from;
+    long size = from[1];
+    
+    BOX_LOAD(__box);
+    
+    if (box_reallocated(__box, size)) return -1;
+    
+    memcpy(BOXB + BOXS - size, (void *) from[0], size);
+    BOXH += from[5];
+    
+    from[1] = 0;
+    from[5] = 0;
+    
+    return 0;
 }
 
 #pragma mark - Set
 
 void array_set(box_t __box, long __position, const void *__value, long __type)
 {
-    box_free_value(box_get(__box, __position));
+    BOX_LOAD(__box);
+    
+    BOXH -= ARRAY_OTHER(SLOT(box_get(__box, __position)));
+    box_free_value(__box, box_get(__box, __position));
     
     arrset(__position);
 }
 
 void array_set_boolean(box_t __box, long __index, long __value)
 {
-    array_set(__box, __index * V2S, &__value, MINIBOX_TYPE_BOOLEAN);
+    array_set(__box, __index * V1S, &__value, MINIBOX_TYPE_BOOLEAN);
 }
 
 void array_set_null(box_t __box, long __index)
 {
     long v =0;
-    array_set(__box, __index * V2S, &v, MINIBOX_TYPE_NULL);
+    array_set(__box, __index * V1S, &v, MINIBOX_TYPE_NULL);
+}
+
+void array_set_number(box_t __box, long __index, double __value)
+{
+    array_set(__box, __index * V1S, &__value, MINIBOX_TYPE_NUMBER);
 }
 
-void array_set_number(box_t __box, long __index, long __value)
+void array_set_integer(box_t __box, long __index, long __value)
 {
-    array_set(__box, __index * V2S, &__value, MINIBOX_TYPE_NUMBER);
+    array_set(__box, __index * V1S, &__value, MINIBOX_TYPE_INTEGER);
 }
 
 void array_set_string(box_t __box, long __index, int __vmt, const char *__value)
 {
-    array_set(__box, __index * V2S, &__value, MINIBOX_TYPE_STRING + __vmt);
+    array_set(__box, __index * V1S, &__value, MINIBOX_TYPE_STRING + __vmt);
 }
 
 void array_set_box(box_t __box, long __index, int __vmt, long __value)
 {
-    array_set(__box, __index * V2S, &__value, box_type(__value) + __vmt);
+    array_set(__box, __index * V1S, &__value, box_type(__value) + __vmt);
 }
 
 #pragma mark - Add
 
 void array_add(box_t __box, const void *__value, long __type)
 {
-    if (box_reallocated(__box, V2S)) return;
+    BOX_LOAD(__box);
     
-    arrset(BOXS - V2S);
+    if (box_reallocated(__box, V1S)) return;
+    
+    arrset(BOXS - V1S);
 }
 
 void array_add_boolean(box_t __box, long __value)
@@ -112,6 +167,11 @@ void array_add_number(box_t __box, double __value)
     array_add(__box, &__value, MINIBOX_TYPE_NUMBER);
 }
 
+void array_add_integer(box_t __box, long __value)
+{
+    array_add(__box, &__value, MINIBOX_TYPE_INTEGER);
+}
+
 void array_add_string(box_t __box, int __vmt, const char *__value)
 {
     array_add(__box, &__value, MINIBOX_TYPE_STRING + __vmt);
@@ -126,11 +186,13 @@ void array_add_box(box_t __box, int __vmt, box_t __value)
 
 void array_insert(box_t __box, long __index, const void *__value, long __type)
 {
-    long p = __index * V2S;
+    long p = __index * V1S;
+    
+    BOX_LOAD(__box);
     
-    if (box_reallocated(__box, V2S)) return;
+    if (box_reallocated(__box, V1S)) return;
     
-    if (box_move(__box, p, p + V2S, (BOXS - V2S) - p))
+    if (box_move(__box, p, p + V1S, (BOXS - V1S) - p))
         return;
     
     arrset(p);
@@ -152,6 +214,11 @@ void array_insert_number(box_t __box, long __index, double __value)
     array_insert(__box, __index, &__value, MINIBOX_TYPE_NUMBER);
 }
 
+void array_insert_integer(box_t __box, long __index, long __value)
+{
+    array_insert(__box, __index, &__value, MINIBOX_TYPE_INTEGER);
+}
+
 void array_insert_string(box_t __box, long __index, int __vmt, const char *__value)
 {
     array_insert(__box, __index, &__value, MINIBOX_TYPE_STRING + __vmt);
@@ -161,3 +228,165 @@ void array_insert_box(box_t __box, long __index, int __vmt, box_t __value)
 {
     array_insert(__box, __index, &__value, box_type(__value) + __vmt);
 }
+
+#pragma mark - Numbers
+
+static int array_doubles(const value_t *__src, long __count, double *__dst)
+{
+    long i;
+    
+    for (i = 0; i < __count; i++)
+    {
+        if (!VALUE_NUMERIC(__src[i])) return -1;
+        
+        __dst[i] = box_value_number(__src + i);
+    }
+    
+    return 0;
+}
+
+static double array_reduce(box_t __box, box_t __other, int __op)
+{
+    double a[ARRAY_CHUNK], b[ARRAY_CHUNK], r = 0, x;
+    long i, m, n, h;
+    
+    BOX_LOAD(__box);
+    if (__other) BOX_LOAD(__other);
+    
+    n = BOXS / V1S;
+    h = BOXH | (__other ? ((long *) __other)[5] : 0);
+    
+    if (__other && box_size(__other) != BOXS)
+        return NAN;
+    
+    if (ARRAY_PACKED(h))
+        return vector_reduce(__op, BOXB, __other ? box_buffer(__other) : NULL, n);
+    
+    if (ARRAY_INT48(h))
+        return vector_reduce_int48(__op, BOXB, __other ? box_buffer(__other) : NULL, n);
+    
+    for (i = 0; i < n; i += m)
+    {
+        m = n - i < ARRAY_CHUNK ? n - i : ARRAY_CHUNK;
+        
+        if (array_doubles(BOXB + i * V1S, m, a) ||
+            (__other && array_doubles(box_get(__other, i * V1S), m, b)))
+            return NAN;
+        
+        x = vector_reduce(__op, a, b, m);
+        
+        if (!i) r = x;
+        else if (__op == VECTOR_MIN) r = x < r ? x : r;
+        else if (__op == VECTOR_MAX) r = x > r ? x : r;
+        else r += x;
+    }
+    
+    return r;
+}
+
+/*
+ * MINIBOX_TYPE_NUMBER for packed double arrays (and empty ones),
+ * MINIBOX_TYPE_INTEGER for packed integer arrays, 0 otherwise. Only the
+ * first can be viewed through array_numbers().
+ */
+int array_packed(box_t __box)
+{
+    BOX_LOAD(__box);
+    
+    if (ARRAY_PACKED(BOXH)) return MINIBOX_TYPE_NUMBER;
+    if (ARRAY_INT48(BOXH)) return MINIBOX_TYPE_INTEGER;
+    
+    return 0;
+}
+
+const double* array_numbers(box_t __box)
+{
+    BOX_LOAD(__box);
+    
+    return ARRAY_PACKED(BOXH) ? BOXB : NULL;
+}
+
+long array_copy_numbers(box_t __box, long __index, long __count, double *__dst)
+{
+    long n;
+    
+    BOX_LOAD(__box);
+    n = BOXS / V1S - __index;
+    
+    if (__index < 0 || n < 0) return -1;
+    
+    if (__count > n) __count = n;
+    
+    if (ARRAY_PACKED(BOXH))
+        memcpy(__dst, BOXB + __index * V1S, __count * sizeof(double));
+    else if (array_doubles(BOXB + __index * V1S, __count, __dst))
+        return -1;
+    
+    return __count;
+}
+
+long array_copy_int64(box_t __box, long __index, long __count, long *__dst)
+{
+    const value_t *src;
+    long i, n;
+    double v;
+    
+    BOX_LOAD(__box);
+    src = BOXB;
+    n = BOXS / V1S - __index;
+    
+    if (__index < 0 || n < 0) return -1;
+    
+    if (__count > n) __count = n;
+    
+    if (ARRAY_INT48(BOXH))
+    {
+        for (i = 0; i < __count; i++)
+            __dst[i] = VALUE_INT48(src[__index + i]);
+        
+        return __count;
+    }
+    
+    for (i = 0; i < __count; i++)
+    {
+        if (!VALUE_NUMERIC(src[__index + i])) return -1;
+        
+        if (VALUE_TAGGED(src[__index + i]))
+        {
+            __dst[i] = VALUE_INTEGER(src[__index + i]);
+            continue;
+        }
+        
+        v = box_value_number(src + __index + i);
+        __dst[i] = v >= -0x1p63 && v < 0x1p63 ? (long) v : 0;
+    }
+    
+    return __count;
+}
+
+double array_sum(box_t __box)
+{
+    return array_reduce(__box, 0, VECTOR_SUM);
+}
+
+double array_min(box_t __box)
+{
+    return array_reduce(__box, 0, VECTOR_MIN);
+}
+
+double array_max(box_t __box)
+{
+    return array_reduce(__box, 0, VECTOR_MAX);
+}
+
+double array_mean(box_t __box)
+{
+    double sum = array_sum(__box);
+    
+    return sum / (BOXS / V1S);
+}
+
+double array_dot(box_t __box, box_t __other)
+{
+    return array_reduce(__box, __other, VECTOR_DOT);
+}
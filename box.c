@@ -19,6 +19,7 @@
 //  limitations under the License.
 //
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -26,20 +27,39 @@
 
 #define BOX ((long *) __box)
 
+static __thread long depth_active = BOX_DEPTH;
+
+/*
+ * Sets the deepest nesting the parsers of the calling thread accept
+ * (BOX_DEPTH when zero or less) and returns the previous limit.
+ */
+long depth_use(long __depth)
+{
+    long prev = depth_active;
+    depth_active = __depth > 0 ? __depth : BOX_DEPTH;
+    return prev;
+}
+
+long depth_current(void)
+{
+    return depth_active;
+}
+
 box_t box_create(long __type)
 {
     long *box;
     void *buffer;
+    box_t arena = arena_current();
     
-    if (!(box = malloc(32)))
+    if (!(box = arena_alloc(arena, BOX_HEADER)))
     {
         printf("<< minibox::box::new_box->malloc() >>\nError al recervar memoria.\n");
         return 0;
     }
     
-    if (!(buffer = malloc(32)))
+    if (!(buffer = arena_alloc(arena, 32)))
     {
-        free(box);
+        arena_free(arena, box);
         printf("<< minibox::box::new_box->malloc() >>\nError al recervar memoria.\n");
         return 0;
     }
@@ -48,6 +68,9 @@ box_t box_create(long __type)
     box[1] = 0;
     box[2] = __type;
     box[3] = 32;
+    box[4] = arena;
+    box[5] = 0;
+    box[6] = 0;
     
     return (long) box;
 }
@@ -56,9 +79,11 @@ int box_allocated(box_t __box, long __size)
 {
     void *tmp;
     
-    if (!(tmp = malloc(__size)))
+    if (!(tmp = arena_alloc(BOXA, __size)))
         return -1;
     
+    arena_free(BOXA, BOXB);
+    
     BOX[0] = (long) tmp;
     BOX[1] = __size;
     BOX[3] = 0;
@@ -74,11 +99,11 @@ int box_reallocated(box_t __box, long __size)
     
     if (m < s)
     {
-        if (m == 0) return -1;
+        if (m <= 0) return -1;
         
         while (m < s) m *= 2;
         
-        if (!(tmp = realloc(BOXB, m)))
+        if (!(tmp = arena_realloc(BOXA, BOXB, BOXM, m)))
         {
             printf("<< minibox::box::box_reallocated->realloc() >>\nError al recervar memoria.\n");
             return -1;
@@ -98,6 +123,12 @@ int box_finalize(box_t __box)
     void *tmp;
     long s = BOXS;
     
+    if (BOXA || BOXM < 0)
+    {
+        if (BOXM > 0) BOX[3] = 0;
+        return 0;
+    }
+    
     if (!(tmp = realloc(BOXB, s)))
     {
         printf("<< minibox::box::box_reallocated->realloc() >>\nError al recervar memoria.\n");
@@ -111,11 +142,13 @@ int box_finalize(box_t __box)
 
 void* box_buffer(box_t __box)
 {
+    BOX_LOAD(__box);
     return BOXB;
 }
 
 long box_size(box_t __box)
 {
+    BOX_LOAD(__box);
     return BOXS;
 }
 
@@ -140,48 +173,256 @@ int box_move(box_t __box, long __src, long __dst, long __size)
     return !memmove(BOXB + __dst, BOXB + __src, __size);
 }
 
-void box_free_value(void *__value)
+value_t box_value(box_t __box, long __type, const void *__value)
+{
+    value_t v;
+    const char *str;
+    long len, n, *p;
+    
+    switch (__type)
+    {
+        case MINIBOX_TYPE_NUMBER:
+            v = *(const value_t *) __value;
+            return (v & ~(1UL << 63)) > 0x7FF0000000000000UL ? VALUE_NAN : v;
+            
+        case MINIBOX_TYPE_INTEGER:
+            n = *(const long *) __value;
+            
+            if (VALUE_INT48_FITS(n))
+                return VALUE_MAKE(MINIBOX_INT48, n & VALUE_PAYLOAD);
+            
+            if (!(p = arena_alloc(BOXA, sizeof(long))))
+            {
+                ERROR(BOX_MEMORY_ERROR, "box_value()")
+                return VALUE_NAN;
+            }
+            
+            *p = n;
+            return VALUE_MAKE(MINIBOX_INT64, p);
+            
+        case MINIBOX_TYPE_NULL:
+            return VALUE_MAKE(MINIBOX_TYPE_NULL, 0);
+            
+        case MINIBOX_TYPE_BOOLEAN:
+            return VALUE_MAKE(MINIBOX_TYPE_BOOLEAN, *(const long *) __value != 0);
+            
+        case MINIBOX_TYPE_STRING:
+        case MINIBOX_TPAR_STRING:
+            str = *(const char **) __value;
+            
+            if (!str || (len = strnlen(str, VALUE_SHORT_MAX + 1)) > VALUE_SHORT_MAX)
+                break;
+            
+            v = box_short(str, len);
+            
+            if (__type == MINIBOX_TPAR_STRING)
+                arena_free(BOXA, (void *) str);
+            
+            return v;
+            
+        default: break;
+    }
+    
+    return VALUE_MAKE(__type, VALUE_PTR(*(const value_t *) __value));
+}
+
+value_t box_short(const char *__str, long __len)
+{
+    value_t v = 0;
+    
+    memcpy((char *) &v + VALUE_SHORT_OFFSET, __str, __len);
+    
+    return v | VALUE_MAKE(MINIBOX_SHORT_STRING, 0);
+}
+
+long box_value_type(const void *__value)
+{
+    long type = VALUE_TYPE(SLOT(__value));
+    
+    if (type == MINIBOX_SHORT_STRING)
+        return MINIBOX_TYPE_STRING;
+    
+    if (type == MINIBOX_INT48 || type == MINIBOX_INT64)
+        return MINIBOX_TYPE_INTEGER;
+    
+    return type & ~MINIBOX_MEMORY_RELEASE;
+}
+
+long box_value_boolean(const void *__value)
+{
+    return VALUE_PTR(SLOT(__value));
+}
+
+double box_value_number(const void *__value)
+{
+    value_t v = SLOT(__value);
+    
+    if (VALUE_TAGGED(v) && VALUE_NUMERIC(v))
+        return (double) VALUE_INTEGER(v);
+    
+    return *(const double *) __value;
+}
+
+long box_value_integer(const void *__value)
+{
+    value_t v = SLOT(__value);
+    double d;
+    
+    if (VALUE_TAGGED(v))
+        return VALUE_NUMERIC(v) ? VALUE_INTEGER(v) : 0;
+    
+    d = *(const double *) __value;
+    
+    return d >= -0x1p63 && d < 0x1p63 ? (long) d : 0;
+}
+
+char* box_value_string(const void *__value)
+{
+    return VALUE_STRING(SLOT(__value));
+}
+
+box_t box_value_box(const void *__value)
 {
-    long type = *((long *) (__value + MINIBOX_TYPE));
-    switch (type)
+    return (box_t) VALUE_PTR(SLOT(__value));
+}
+
+void box_free_value(box_t __box, void *__value)
+{
+    value_t v = SLOT(__value);
+    
+    if (BOXA || !VALUE_TAGGED(v)) return;
+    
+    switch (VALUE_TYPE(v))
     {
         case MINIBOX_TPAR_STRING:
-            free(*(void **)__value);
+        case MINIBOX_INT64:
+            free((void *) VALUE_PTR(v));
             break;
             
         case MINIBOX_TPAR_ARRAY:
         case MINIBOX_TPAR_OBJECT:
-            free_box(*(box_t *)__value);
+            free_box((box_t) VALUE_PTR(v));
             break;
             
         default: break;
     }
 }
 
-void free_box(box_t __box)
+/*
+ * Nested boxes and links are collected on an explicit stack rather than
+ * freed recursively, so trees as deep as depth_use() allows are released
+ * without exhausting the thread stack.
+ */
+typedef struct
+{
+    box_t *box;
+    long count;
+    long size;
+} box_stack_t;
+
+static void box_push(box_stack_t *__stack, box_t __box)
+{
+    box_t *tmp;
+    
+    if (!__box) return;
+    
+    if (__stack->count == __stack->size)
+    {
+        if (!(tmp = malloc(__stack->size * 2 * sizeof(box_t))))
+        {
+            free_box(__box);
+            return;
+        }
+        
+        memcpy(tmp, __stack->box, __stack->count * sizeof(box_t));
+        if (__stack->size > BOX_FRAMES) free(__stack->box);
+        
+        __stack->box = tmp;
+        __stack->size *= 2;
+    }
+    
+    __stack->box[__stack->count++] = __box;
+}
+
+static void box_push_value(box_stack_t *__stack, void *__value)
+{
+    value_t v = SLOT(__value);
+    
+    if (!VALUE_TAGGED(v)) return;
+    
+    switch (VALUE_TYPE(v))
+    {
+        case MINIBOX_TPAR_STRING:
+        case MINIBOX_INT64:
+            free((void *) VALUE_PTR(v));
+            break;
+            
+        case MINIBOX_TPAR_ARRAY:
+        case MINIBOX_TPAR_OBJECT:
+            box_push(__stack, (box_t) VALUE_PTR(v));
+            break;
+            
+        default: break;
+    }
+}
+
+static void box_release(box_stack_t *__stack, box_t __box)
 {
     long i, s = BOXS;
     
+    box_push(__stack, BOXL);
+    
+    if (BOXA) return;
+    
     switch (BOXT)
     {
         case MINIBOX_TYPE_ARRAY:
         case MINIBOX_TPAR_ARRAY:
-            for (i = 0; i < s; i += V2S)
-                box_free_value(BOXB + i);
+            for (i = 0; i < s; i += V1S)
+                box_push_value(__stack, BOXB + i);
             break;
             
         case MINIBOX_TYPE_OBJECT:
         case MINIBOX_TPAR_OBJECT:
-            for (i = 0; i < s; i += V3S)
+            for (i = 0; i < s; i += V2S)
             {
-                box_free_value(BOXB + i);
-                free(*(char **)(BOXB + i + MINIBOX_KEY));
+                box_push_value(__stack, BOXB + i);
+                
+                if (!KEY_INTERNED(*(char **)(BOXB + i + MINIBOX_KEY)))
+                    free(*(char **)(BOXB + i + MINIBOX_KEY));
             }
+            free((void *) BOXH);
             break;
             
         case MINIBOX_TYPE_STREAM:
+            if (BOXM == STREAM_MAPPED)
+            {
+                stream_unmap(__box);
+                free(BOX);
+                return;
+            }
+            break;
+            
+        case MINIBOX_TYPE_READER:
+            xml_reader_release(__box);
             break;
             
+        case MINIBOX_TYPE_KEYS:
+            keys_release(__box);
+            return;
+            
+        case MINIBOX_TYPE_PARSER:
+            json_parser_release(__box);
+            return;
+            
+        case MINIBOX_TYPE_LINES:
+            lines_release(__box);
+            return;
+            
+        case MINIBOX_TYPE_ARENA:
+            arena_release(__box);
+            return;
+            
         default: return;
     }
     
@@ -189,81 +430,55 @@ void free_box(box_t __box)
     free(BOX);
 }
 
-char* box_copy_str(const char *__key)
+void free_box(box_t __box)
 {
-    char *str;
+    box_t frames[BOX_FRAMES];
+    box_stack_t stack = { frames, 0, BOX_FRAMES };
     
-    if (!(str = malloc(strlen(__key) + 1)))
-        return NULL;
+    box_push(&stack, __box);
     
-    strcpy(str, __key);
+    while (stack.count)
+        box_release(&stack, stack.box[--stack.count]);
     
-    return str;
+    if (stack.size > BOX_FRAMES) free(stack.box);
 }
 
-char * box_number_string(double __value)
+void box_link(box_t __box, box_t __link)
 {
-    static char buf[32];
-    /*******************************************************
-     AQUI HAY UN BUG.
-     LA PARTE DECIMAL NO ES CORRECTA CON ALGUNOS NUMEROS.
-     QUITA LOS CEROS AL PRINCIPIO DE LA PARATE DECIMAL.
-     
-    unsigned long ent = (long)__value;
-    unsigned fra = 0;
-    
-    __value = fabs(__value);
-    __value -= ent;
-    __value *= 1000000000;
-    
-    fra = __value;
-    
-    if(fra < __value) ++fra;
-    else if(fra > __value) --fra;
-    
-    if(fra) while(!(fra % 10)) fra /= 10;
-    
-    if (fra == 0)
-        sprintf(buf, "%ld", ent);
-    else
-        sprintf(buf, "%ld.%u", ent, fra);
-     
-    ******************************************************/
-    
-    
-    if (__value - (long)__value == 0.0) {
-        sprintf(buf, "%ld", (long) __value);
-    } else {
-        sprintf(buf, "%f", __value);
-        
-        long i;
-        
-        for (i = strlen(buf) -1; i != 0; i--) {
-            if (buf[i] == '0') {
-                buf[i] = 0;
-            } else
-                break;
-        }
-    }
+    BOX[6] = __link;
+}
+
+char* box_copy_str(box_t __arena, const char *__key)
+{
+    char *str;
+    
+    if (!(str = arena_alloc(__arena, strlen(__key) + 1)))
+        return NULL;
     
-    return buf;
+    strcpy(str, __key);
+    
+    return str;
 }
 
-void box_put_value(box_t __str, long __type, const void *__value, int *level)
+void box_put_value(box_t __str, value_t __value, int *level)
 {
-    switch (__type) {
+    switch (VALUE_TYPE(__value)) {
         case MINIBOX_TYPE_NULL:
             stream_add(__str, MINIBOX_VALUE_NULL);
             break;
         case MINIBOX_TYPE_BOOLEAN:
-            if (*(long *) __value == 0) {
+            if (VALUE_PTR(__value) == 0) {
                 stream_add(__str, MINIBOX_VALUE_FALSE);
             } else {
                 stream_add(__str, MINIBOX_VALUE_TRUE);
             }
             break;
         case MINIBOX_TYPE_NUMBER:
-            stream_add_number(__str, *(double *) __value);
+            stream_add_number(__str, box_value_number(&__value));
+            break;
+        case MINIBOX_INT48:
+        case MINIBOX_INT64:
+            stream_add_integer(__str, VALUE_INTEGER(__value));
             break;
             
         default: break;
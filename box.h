@@ -31,15 +31,36 @@ extern "C" {
 
 #define V1S 0x8
 #define V2S 0x10
-#define V3S 0x18
 
 #define BOXB ( (void *) ((long *) __box)[0] )
 #define BOXS ( ((long *) __box)[1] )
 #define BOXT ( ((long *) __box)[2] )
 #define BOXM ( ((long *) __box)[3] )
+#define BOXA ( ((long *) __box)[4] )
+#define BOXH ( ((long *) __box)[5] )
+#define BOXL ( ((long *) __box)[6] )
+
+#define BOX_HEADER 0x38
+
+#define STREAM_MAPPED -1
+
+/*
+ * Deepest nesting the parsers accept unless depth_use() says otherwise.
+ */
+#define BOX_DEPTH 0x400
+#define BOX_FRAMES 0x20
+
+/*
+ * Containers of a lazy JSON document keep BOXM at BOX_LAZY until they
+ * are first touched; BOX_LOAD() fills them in from the document tape.
+ */
+#define BOX_LAZY -2
+#define BOX_LOAD(b) if (((long *) (b))[3] == BOX_LAZY) json_load(b)
 
 #define BOX_CREATE_ERROR "The box could not be created."
 #define BOX_MEMORY_ERROR "Could not reserve memory."
+#define BOX_DEPTH_ERROR "Maximum nesting depth exceeded."
+#define BOX_UTF8_ERROR "Invalid UTF-8 sequence."
 #define ERROR(x, s) printf("\t%s\nError::xml->%s\n", x, s);
 #define EIF(c, x, s) if(c){printf("\t%s\nError::xml->%s\n",x,s);return -1;}
 #define WARNING(x, s) printf("\t%s\nWarning::xml->%s\n", x, s);
@@ -53,15 +74,148 @@ enum {
     MINIBOX_TPAR_ARRAY  = MINIBOX_TYPE_ARRAY  + 1,
     MINIBOX_TPAR_OBJECT = MINIBOX_TYPE_OBJECT + 1,
     MINIBOX_FALSE       = MINIBOX_TYPE_BOOLEAN,
-    MINIBOX_TRUE        = MINIBOX_TYPE_BOOLEAN + 1
+    MINIBOX_TRUE        = MINIBOX_TYPE_BOOLEAN + 1,
+    MINIBOX_SHORT_STRING = 0x7,
+    MINIBOX_INT64       = 0x1,
+    MINIBOX_INT48       = 0x3
 };
 
 enum {
     MINIBOX_VALUE = 0x0,
-    MINIBOX_TYPE = 0x8,
-    MINIBOX_KEY = 0x10
+    MINIBOX_KEY = 0x8
+};
+
+/*
+ * Array slots hold one value (V1S) and object slots a value and its key
+ * (V2S). Values are NaN-boxed: doubles are kept as they are, with every
+ * NaN folded into VALUE_NAN, and the other types live in the negative
+ * NaN space with the type in the top 16 bits (0xFFF0 | type) and a 48
+ * bit payload (pointer or boolean).
+ */
+typedef unsigned long value_t;
+
+#define VALUE_NAN 0x7FF8000000000000UL
+#define VALUE_PAYLOAD 0xFFFFFFFFFFFFUL
+#define VALUE_TAGGED(v) ((v) >= 0xFFF1000000000000UL)
+#define VALUE_TYPE(v) (VALUE_TAGGED(v) ? (long) ((v) >> 48 & 0xF) : MINIBOX_TYPE_NUMBER)
+#define VALUE_PTR(v) ((v) & VALUE_PAYLOAD)
+#define VALUE_MAKE(t, p) ((value_t) (0xFFF0 | (t)) << 48 | (value_t) (p))
+#define SLOT(p) (*(value_t *) (p))
+
+/*
+ * Integers that fit in 48 bits are kept in the payload (MINIBOX_INT48),
+ * larger ones are boxed in an owned long (MINIBOX_INT64).
+ */
+#define VALUE_INT48(v) ((long) ((v) << 16) >> 16)
+#define VALUE_INT48_FITS(i) ((i) >= -(1L << 47) && (i) < (1L << 47))
+#define VALUE_INTEGER(v) (VALUE_TYPE(v) == MINIBOX_INT48 ? VALUE_INT48(v) : *(long *) VALUE_PTR(v))
+#define VALUE_NUMERIC(v) (!VALUE_TAGGED(v) || VALUE_TYPE(v) == MINIBOX_INT48 || \
+    VALUE_TYPE(v) == MINIBOX_INT64)
+
+/*
+ * Strings of up to VALUE_SHORT_MAX bytes are kept in the payload itself
+ * (MINIBOX_SHORT_STRING), NUL terminated, so they need no allocation.
+ * VALUE_STRING() must be given the slot (or a copy of it) as an lvalue.
+ */
+#define VALUE_SHORT_MAX 5
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define VALUE_SHORT_OFFSET 2
+#else
+#define VALUE_SHORT_OFFSET 0
+#endif
+
+/*
+ * Keys handed out by a key table (keys.c) are tagged in the top bit and
+ * preceded by their hash and length. Objects never release them.
+ */
+#define KEY_TAG (1UL << 63)
+#define KEY_INTERNED(k) ((unsigned long) (k) >> 63)
+#define KEY_STR(k) ((char *) ((unsigned long) (k) & ~KEY_TAG))
+#define KEY_HASH(k) (((unsigned *) KEY_STR(k))[-2])
+#define KEY_LENGTH(k) (((unsigned *) KEY_STR(k))[-1])
+#define KEY_SIZE(k) (KEY_INTERNED(k) ? (long) KEY_LENGTH(k) : (long) strlen(KEY_STR(k)))
+
+#define VALUE_STRING(v) (VALUE_TYPE(v) == MINIBOX_SHORT_STRING ? \
+    (char *) &(v) + VALUE_SHORT_OFFSET : (char *) VALUE_PTR(v))
+
+typedef struct
+{
+    const char *src;
+    long len;
+    long pos;
+    unsigned long string;
+    unsigned long escaped;
+    unsigned long scalar;
+    long valid;
+    int utf8;
+    int invalid;
+} scan_t;
+
+void scan_init(scan_t *__scan, const char *__src, long __len);
+
+long scan_json(scan_t *__scan, long *__index, long __max);
+long scan_string(const char *__src, long __len);
+long scan_copy(char *__dst, const char *__src, long __len);
+long scan_escape(const char *__src, long __len, const char *__set);
+
+int utf8_current(void);
+int utf8_range(const char *__src, long *__pos, long __end, int __last);
+int utf8_check(const char *__src, long __len);
+int utf8_encode(char *__dst, unsigned __cp);
+
+enum {
+    VECTOR_SUM,
+    VECTOR_MIN,
+    VECTOR_MAX,
+    VECTOR_DOT
 };
 
+double vector_reduce(int __op, const double *__a, const double *__b, long __n);
+double vector_reduce_int48(int __op, const value_t *__a, const value_t *__b, long __n);
+
+typedef struct __path
+{
+    struct __path *child;
+    struct __path *next;
+    long len;
+    long index;
+    int leaf;
+    char key[];
+} path_t;
+
+path_t* path_compile(const char **__paths, int __items);
+
+void path_free(path_t *__path);
+
+const path_t* path_key(const path_t *__path, const char *__key, long __len);
+
+const path_t* path_item(const path_t *__path, long __index);
+
+long depth_current(void);
+
+box_t arena_current(void);
+
+void* arena_alloc(box_t __arena, long __size);
+
+void* arena_realloc(box_t __arena, void *__ptr, long __old, long __size);
+
+void arena_free(box_t __arena, void *__ptr);
+
+void arena_retain(box_t __arena, box_t __heap);
+
+void arena_release(box_t __arena);
+
+box_t keys_current(void);
+
+char* keys_intern(box_t __keys, const char *__str, long __len);
+
+void keys_release(box_t __keys);
+
+void lines_release(box_t __lines);
+
+unsigned object_hash_len(const char *__str, long __len);
+
 box_t box_create(long __type);
 
 int box_allocated(box_t __box, long __size);
@@ -70,6 +224,8 @@ int box_reallocated(box_t __box, long __size);
 
 int box_finalize(box_t __box);
 
+void box_link(box_t __box, box_t __link);
+
 void box_set(box_t __box, long __position, const void *__value);
 
 void* box_get(box_t __box, long __position);
@@ -82,13 +238,41 @@ long box_size(box_t __box);
 
 long box_type(box_t __box);
 
-void box_free_value(void *__value);
+value_t box_value(box_t __box, long __type, const void *__value);
+
+value_t box_short(const char *__str, long __len);
+
+void box_free_value(box_t __box, void *__value);
+
+void array_add(box_t __box, const void *__value, long __type);
+
+int array_take(box_t __box, box_t __from);
+
+void object_put(box_t __box, const char *__key, int _kf, const void *__value, long __type);
+
+char* box_copy_str(box_t __arena, const char *__str);
+
+#define NUMBER_STRING_MAX 0x20
+
+long number_parse(const char *__src, double *__value);
+
+long number_format(double __value, char *__buf);
+
+long number_integer(const char *__src, long *__value);
+
+long number_format_integer(long __value, char *__buf);
+
+int stream_writable(box_t __stream);
+
+void stream_unmap(box_t __box);
+
+void json_load(box_t __box);
 
-char* box_copy_str(const char *__str);
+void json_parser_release(box_t __parser);
 
-char * box_number_string(double __value);
+void xml_reader_release(box_t __reader);
 
-void box_put_value(box_t __str, long __type, const void *__value, int *level);
+void box_put_value(box_t __str, value_t __value, int *level);
     
 #ifdef __cplusplus
 }
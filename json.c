@@ -21,38 +21,353 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "box.h"
 
+#define JSON_INDEX 0x400
+#define JSON_PARALLEL_MIN 0x100000
+#define JSON_PARALLEL_BLOCK 0x40000
+#define JSON_THREADS_MAX 0x100
+#define JSON_FRAMES 0x20
+#define JSON_ESCAPE_ERROR "Invalid escape sequence."
+
 typedef struct __json
 {
     const char *source;
     const char *pointer;
-    int obj_lev;
-    int arr_lev;
+    int insitu;
+    int vmt;
+    scan_t scan;
+    const char *str;
+    long len;
+    double num;
+    long integer;
+    int type;
+    long at;
+    long count;
+    const path_t *path;
+    int threads;
+    long depth;
+    char *text;
+    long size;
+    int invalid;
+    long index[JSON_INDEX];
 } json_t;
 
-void json_object(json_t *__json, box_t __obj);
+int json_object(json_t *__json, box_t __obj);
+static int json_parallel(json_t *__json, box_t __box, long __depth);
 void object_json(box_t __box, box_t __str, int *level);
+void object_json_compact(box_t __box, box_t __str);
+
+static void json_init(json_t *__json, const char *__src, long __len)
+{
+    __json->source = __src;
+    __json->pointer = __src;
+    __json->insitu = 0;
+    __json->vmt = MINIBOX_MEMORY_RELEASE;
+    __json->at = 0;
+    __json->count = 0;
+    __json->path = NULL;
+    __json->threads = 0;
+    __json->depth = depth_current();
+    __json->text = NULL;
+    __json->size = 0;
+    __json->invalid = 0;
+    
+    scan_init(&__json->scan, __src, __len);
+}
+
+/*
+ * Moves to the next structural position found by the scanner and
+ * returns its character, leaving the pointer just past it. Input that
+ * the scanner finds not to be UTF-8 ends the walk with invalid set.
+ */
+static int json_next(json_t *__json)
+{
+    if (__json->at == __json->count)
+    {
+        __json->at = 0;
+        __json->count = __json->invalid ? 0 : scan_json(&__json->scan, __json->index, JSON_INDEX);
+        
+        if (__json->scan.invalid && !__json->invalid++)
+            ERROR(BOX_UTF8_ERROR, "json_next()")
+        
+        if (__json->invalid || !__json->count)
+        {
+            __json->count = 0;
+            return 0;
+        }
+    }
+    
+    __json->pointer = __json->source + __json->index[__json->at++] + 1;
+    
+    return __json->pointer[-1];
+}
+
+static int json_hex(const char *__src, const char *__end, unsigned *__cp)
+{
+    int i, c;
+    
+    if (__end - __src < 4) return -1;
+    
+    for (*__cp = 0, i = 0; i < 4; i++)
+    {
+        c = __src[i];
+        
+        if (c >= '0' && c <= '9') c -= '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') c = (c | 0x20) - 'a' + 10;
+        else return -1;
+        
+        *__cp = *__cp << 4 | c;
+    }
+    
+    return 0;
+}
+
+/*
+ * Decodes the escapes of __len bytes at __src into __dst, which may be
+ * __src itself since no escape is shorter than what it stands for, and
+ * returns the decoded length or -1 if an escape is malformed. Short runs
+ * between escapes are copied here, longer ones by the scanner's vector
+ * kernels; surrogate pairs are joined into a single UTF-8 sequence.
+ */
+static long json_unescape(char *__dst, const char *__src, long __len)
+{
+    const char *end = __src + __len, *s;
+    char *d = __dst;
+    unsigned cp, lo;
+    long n;
+    
+    for (;;)
+    {
+        for (n = 0; n < 8 && __src + n < end && __src[n] != '\\'; n++)
+            d[n] = __src[n];
+        
+        if (n == 8)
+            n += scan_copy(d + 8, __src + 8, end - __src - 8);
+        
+        d += n;
+        s = __src + n;
+        
+        if (s == end) break;
+        if (s + 1 == end) return -1;
+        
+        __src = s + 2;
+        
+        switch (s[1])
+        {
+            case '"': case '\\': case '/': *d++ = s[1]; break;
+            case 'b': *d++ = '\b'; break;
+            case 'f': *d++ = '\f'; break;
+            case 'n': *d++ = '\n'; break;
+            case 'r': *d++ = '\r'; break;
+            case 't': *d++ = '\t'; break;
+                
+            case 'u':
+                if (json_hex(__src, end, &cp)) return -1;
+                
+                __src += 4;
+                
+                if (cp >= 0xD800 && cp < 0xDC00)
+                {
+                    if (end - __src < 6 || __src[0] != '\\' || __src[1] != 'u' ||
+                        json_hex(__src + 2, end, &lo) || lo < 0xDC00 || lo >= 0xE000)
+                        return -1;
+                    
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    __src += 6;
+                }
+                else if (cp >= 0xDC00 && cp < 0xE000)
+                    return -1;
+                
+                d += utf8_encode(d, cp);
+                break;
+                
+            default: return -1;
+        }
+    }
+    
+    return d - __dst;
+}
+
+/*
+ * Replaces the string view by its decoded text, written over the source
+ * when parsing in situ and to the parser's text buffer otherwise. The
+ * view is left as it was on failure.
+ */
+static int json_decode(json_t *__json)
+{
+    char *dst = (char *) __json->str, *tmp;
+    long n, size = __json->size;
+    
+    if (!__json->insitu)
+    {
+        while (size < __json->len) size = size * 2 + 0x40;
+        
+        if (size != __json->size)
+        {
+            if (!(tmp = realloc(__json->text, size)))
+            {
+                ERROR(BOX_MEMORY_ERROR, "json_decode()")
+                return -1;
+            }
+            
+            __json->text = tmp;
+            __json->size = size;
+        }
+        
+        dst = __json->text;
+    }
+    
+    if ((n = json_unescape(dst, __json->str, __json->len)) < 0)
+    {
+        ERROR(JSON_ESCAPE_ERROR, "json_decode()")
+        return -1;
+    }
+    
+    __json->str = dst;
+    __json->len = n;
+    
+    return 0;
+}
+
+/*
+ * Tokenizer shared by the tree builder and the event parser. Strings are
+ * left as a view (str, len) over their decoded text, which is the source
+ * itself unless they hold escapes, and numbers are parsed into integer or
+ * num, as told by type; literals and operators are returned by their
+ * first character. A malformed escape ends the walk with invalid set.
+ */
+static int json_token(json_t *__json)
+{
+    int c = json_next(__json);
+    long n;
+    
+    switch (c)
+    {
+        case '"':
+            __json->str = __json->pointer;
+            
+            if (json_next(__json) != '"')
+                return 0;
+            
+            __json->len = __json->pointer - 1 - __json->str;
+            
+            if (memchr(__json->str, '\\', __json->len) && json_decode(__json))
+            {
+                __json->invalid = 1;
+                return 0;
+            }
+            break;
+            
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+        case '-':
+            if ((n = number_integer(__json->pointer - 1, &__json->integer)))
+            {
+                __json->type = MINIBOX_TYPE_INTEGER;
+                __json->pointer += n - 1;
+            }
+            else
+            {
+                __json->type = MINIBOX_TYPE_NUMBER;
+                __json->pointer += number_parse(__json->pointer - 1, &__json->num) - 1;
+            }
+            break;
+            
+        default: break;
+    }
+    
+    return c;
+}
 
 box_t object_from_json_string(const char *__src)
 {
     box_t obj = new_object();
-    json_t json = { __src, __src, -1, -1 };
+    json_t json;
+    
+    json_init(&json, __src, strlen(__src));
+    
+    if (json_object(&json, obj))
+    {
+        free_box(obj);
+        obj = 0;
+    }
+    
+    return obj;
+}
+
+/*
+ * Parses the stream in place and takes ownership of it. Keys and strings
+ * are terminated inside the stream buffer instead of being copied, so the
+ * tree is built in an arena (the active one, or a private one released
+ * together with the returned object) that keeps the stream alive.
+ */
+box_t object_from_json_stream(box_t __stream)
+{
+    box_t obj, own = 0;
+    box_t arena = arena_current();
+    char *src = box_buffer(__stream);
+    json_t json;
+    
+    if (stream_writable(__stream) || (!arena && !(arena = own = new_arena())))
+    {
+        ERROR(BOX_CREATE_ERROR, "object_from_json_stream()")
+        free_box(__stream);
+        return 0;
+    }
+    
+    arena_retain(arena, __stream);
+    arena_use(arena);
     
-    json_object(&json, obj);
+    if ((obj = new_object()))
+    {
+        json_init(&json, src, strlen(src));
+        json.insitu = 1;
+        json.vmt = MINIBOX_MEMORY_RETAINT;
+        
+        if (json_object(&json, obj))
+        {
+            free_box(obj);
+            obj = 0;
+        }
+    }
+    
+    if (own)
+    {
+        arena_use(0);
+        
+        if (obj) box_link(obj, own);
+        else free_box(own);
+    }
     
     return obj;
 }
 
 box_t json_stream_from_object(box_t __box)
+{
+    return json_stream_from_object_format(__box, MINIBOX_FORMAT_PRETTY);
+}
+
+box_t json_stream_from_object_format(box_t __box, int __format)
 {
     box_t str = new_stream();
-    int level = 0;
-    object_json(__box, str, &level);
+    json_write_object(__box, str, __format);
     stream_finalize(str);
     return str;
 }
 
+void json_write_object(box_t __box, box_t __stream, int __format)
+{
+    int level = 0;
+    
+    if (__format == MINIBOX_FORMAT_COMPACT)
+        object_json_compact(__box, __stream);
+    else
+        object_json(__box, __stream, &level);
+}
+
 box_t object_from_json_file(const char *__path)
 {
     box_t box;
@@ -70,9 +385,59 @@ box_t object_from_json_file(const char *__path)
     }
     
     src = box_buffer(str);
-    json_t json = { src, src, -1, -1 };
+    json_t json;
+    
+    json_init(&json, src, strlen(src));
+    
+    if (json_object(&json, box))
+    {
+        free_box(box);
+        box = 0;
+    }
+    
+    free_box(str);
     
-    json_object(&json, box);
+    return box;
+}
+
+/*
+ * Builds only what the NULL terminated list of paths asks for, such as
+ * "user.id" or "items[*].price"; everything else is skipped unparsed.
+ */
+box_t object_from_json_string_paths(const char *__src, const char **__paths)
+{
+    box_t obj;
+    path_t *path;
+    json_t json;
+    
+    if (!(path = path_compile(__paths, 1)))
+        return 0;
+    
+    if ((obj = new_object()))
+    {
+        json_init(&json, __src, strlen(__src));
+        json.path = path;
+        
+        if (json_object(&json, obj))
+        {
+            free_box(obj);
+            obj = 0;
+        }
+    }
+    
+    path_free(path);
+    
+    return obj;
+}
+
+box_t object_from_json_file_paths(const char *__path, const char **__paths)
+{
+    box_t str, box;
+    
+    if (!(str = stream_load(__path)))
+        return 0;
+    
+    box = object_from_json_string_paths(box_buffer(str), __paths);
     
     free_box(str);
     
@@ -81,306 +446,1643 @@ box_t object_from_json_file(const char *__path)
 
 int json_file_from_object(box_t __box, const char *__path)
 {
+    return json_file_from_object_format(__box, __path, MINIBOX_FORMAT_PRETTY);
+}
+
+int json_file_from_object_format(box_t __box, const char *__path, int __format)
+{
+    FILE *file;
     box_t str;
+    int err;
     
-    if (!(str = json_stream_from_object(__box)))
+    if (!(file = fopen(__path, "w")))
         return -1;
     
-    if (stream_save(str, __path))
+    if (!(str = new_stream_file(file)))
+    {
+        fclose(file);
         return -1;
+    }
+    
+    json_write_object(__box, str, __format);
     
+    err = stream_flush(str);
     free_box(str);
     
+    if (fclose(file) || err)
+        return -1;
+    
     return 0;
 }
 
-static char * json_string(json_t *__json)
+static char * json_copy(const char *__str, long __len)
 {
     char *str;
-    size_t len = 0;
-    const char *p = __json->pointer;
     
-    while (*p != '"') if (*p != '\0') p++; else return NULL;
+    if (!(str = arena_alloc(arena_current(), __len + 1)))
+        return NULL;
+    
+    memcpy(str, __str, __len);
     
-    len = p++ - __json->pointer;
+    str[__len] = '\0';
     
-    if (!(str = malloc(len + 1)))
-        return NULL;
+    return str;
+}
+
+static char * json_string(json_t *__json)
+{
+    char *str;
     
-    memcpy(str, __json->pointer, len);
+    if (__json->insitu)
+    {
+        str = (char *) __json->str;
+        str[__json->len] = '\0';
+        return str;
+    }
     
-    str[len] = '\0';
+    return json_copy(__json->str, __json->len);
+}
+
+static char * json_key(json_t *__json)
+{
+    box_t keys = keys_current();
     
-    __json->pointer += len +1;
+    if (keys)
+        return keys_intern(keys, __json->str, __json->len);
     
-    return str;
+    return json_string(__json);
 }
 
-static double json_number(json_t *__json)
+/*
+ * Skips the rest of a value whose first token was just read, counting
+ * brackets over the structural positions only.
+ */
+static void json_skip(json_t *__json, int __c)
 {
-    return atof(__json->pointer-1);
+    long depth = __c == '{' || __c == '[';
+    
+    while (depth && (__c = json_next(__json)))
+    {
+        if (__c == '{' || __c == '[') depth++;
+        else if (__c == '}' || __c == ']') depth--;
+    }
 }
 
-void json_array(json_t *__json, box_t __box)
+/*
+ * Tells whether the array just opened is too small to be split, looking
+ * ahead with a copy of the scanner no further than JSON_PARALLEL_MIN
+ * bytes.
+ */
+static int json_small(json_t *__json)
 {
-    box_t box;
-    long level = __json->arr_lev;
-    int nc = 1;
+    scan_t scan = __json->scan;
+    const long *index = __json->index + __json->at;
+    long i, n = __json->count - __json->at, depth = 1;
+    long start = __json->pointer - __json->source, more[0x100];
+    int c;
+    
+    if (__json->scan.len - start < JSON_PARALLEL_MIN)
+        return 1;
+    
+    scan.utf8 = 0;
     
     do
     {
-        switch (*__json->pointer++)
+        for (i = 0; i < n; i++)
         {
-            // { (OBJECT)
-            case 123:
-                __json->obj_lev++;
-                box = new_object();
-                json_object(__json, box);
-                array_add_box(__box, MINIBOX_MEMORY_RELEASE, box);
-                break;
-            //[ (ARRAY)
-            case 91:
-                __json->arr_lev++;
-                box = new_array();
-                json_array(__json, box);
-                array_add_box(__box, MINIBOX_MEMORY_RELEASE, box);
-                break;
-            // ] (ARRAY)
-            case 93:
-                if (level == __json->arr_lev--)
-                    return;
-                break;
-            // " (STRING)
-            case 34:
-                array_add_string(__box, MINIBOX_MEMORY_RELEASE, json_string(__json));
-                break;
-            // 0<->9 (NUMBER)
-            case 48: case 49: case 50: case 51: case 52:
-            case 53: case 54: case 55: case 56: case 57:
-                if (nc)
-                    array_add_number(__box, json_number(__json));
-                nc = 0;
-                break;
-            // t (BOOLEAN)
-            case 116:
-                if (nc)
-                    array_add_boolean(__box, 1);
-                nc = 0;
-                break;
-            // f (BOOLEAN)
-            case 102:
-                if (nc)
-                    array_add_boolean(__box, 0);
-                nc = 0;
-                break;
-            // n (VNULL)
-            case 110:
-                if (nc)
-                    array_add_boolean(__box, 0);
-                nc = 0;
-                break;
-            // , (SEPARATOR)
-            case 44: nc = 1; break;
-                
-            default: break;
+            if (index[i] - start >= JSON_PARALLEL_MIN)
+                return 0;
+            
+            c = __json->source[index[i]];
+            
+            if (c == '{' || c == '[') depth++;
+            else if ((c == '}' || c == ']') && !--depth)
+                return 1;
         }
         
-    } while (*__json->pointer != '\0');
+        index = more;
+    }
+    while ((n = scan_json(&scan, more, 0x100)));
+    
+    return 1;
+}
+
+/*
+ * Frames of the containers being built. With a projection (path), items
+ * and keys that no path goes through are skipped without building
+ * anything, and next is the path below the value being read (NULL once a
+ * path ends, taking the whole value). threads keeps the parallel setting
+ * to restore when a frame that had to be parsed serially is closed.
+ */
+typedef struct
+{
+    box_t box;
+    const path_t *path;
+    const path_t *next;
+    char *key;
+    long n;
+    int object;
+    int is_key;
+    int skip;
+    int threads;
+} json_frame_t;
+
+static void json_put(json_frame_t *__f, const void *__value, long __type)
+{
+    if (!__f->object)
+    {
+        array_add(__f->box, __value, __type);
+        return;
+    }
+    
+    if (!__f->is_key) return;
+    
+    object_put(__f->box, __f->key, MINIBOX_MEMORY_RELEASE, __value, __type);
+    
+    __f->key = NULL;
+    __f->is_key = 0;
 }
 
-void json_object(json_t *__json, box_t __box)
+/*
+ * Builds the container whose opening bracket was just read, and all that
+ * it holds, over an explicit stack of frames. Returns -1 when the
+ * document nests deeper than the json_t allows; what was built so far is
+ * left in the tree.
+ */
+static int json_build(json_t *__json, box_t __box, int __object)
 {
+    json_frame_t frames[JSON_FRAMES], *stack = frames, *f = frames, *tmp;
+    long depth = 1, max = JSON_FRAMES;
+    const path_t *sub;
     box_t box;
-    char *key = NULL;
-    int isKey = 0;
-    int level = __json->obj_lev;
+    value_t v;
+    char *str;
+    int c, r = 0;
     
-    do
+    memset(f, 0, sizeof(json_frame_t));
+    f->box = __box;
+    f->path = __json->path;
+    f->object = __object;
+    f->threads = __json->threads;
+    
+    while ((c = json_token(__json)))
     {
-        switch (*__json->pointer++)
+        if (!f->object && f->path && c != ']' && c != ',')
         {
-            case 123: // {
-    
-                if (__json->obj_lev++ == -1)
+            if (!(sub = path_item(f->path, f->n++)))
+            {
+                json_skip(__json, c);
+                continue;
+            }
+            
+            f->next = sub->leaf ? NULL : sub;
+        }
+        
+        switch (c)
+        {
+            // { [ (OBJECT, ARRAY)
+            case 123:
+            case 91:
+                if (f->object && !f->is_key)
                 {
-                    level = __json->obj_lev;
+                    json_skip(__json, c);
                     break;
                 }
                 
-                box = new_object();
-                json_object(__json, box);
-                object_put_box(__box,
-                               MINIBOX_MEMORY_RELEASE, key,
-                               MINIBOX_MEMORY_RELEASE, box);
-                key = NULL;
-                isKey = 0;
-                break;
+                box = c == 123 ? new_object() : new_array();
+                json_put(f, &box, box_type(box) + MINIBOX_MEMORY_RELEASE);
+                
+                if (depth == __json->depth)
+                {
+                    ERROR(BOX_DEPTH_ERROR, "json_build()")
+                    r = -1;
+                    goto done;
+                }
+                
+                if (c == 91 && __json->threads && !f->next && !json_small(__json))
+                {
+                    if ((r = json_parallel(__json, box, depth + 1)))
+                        goto done;
+                    break;
+                }
+                
+                if (depth == max)
+                {
+                    if (!(tmp = malloc(max * 2 * sizeof(json_frame_t))))
+                    {
+                        ERROR(BOX_MEMORY_ERROR, "json_build()")
+                        r = -1;
+                        goto done;
+                    }
+                    
+                    memcpy(tmp, stack, max * sizeof(json_frame_t));
+                    if (stack != frames) free(stack);
+                    
+                    stack = tmp;
+                    max *= 2;
+                }
                 
-            case 125: // }
+                f = stack + depth++;
+                memset(f, 0, sizeof(json_frame_t));
+                f->box = box;
+                f->path = f[-1].next;
+                f->object = c == 123;
+                f->threads = __json->threads;
                 
-                if (level == __json->obj_lev--) return;
+                if (c == 91) __json->threads = 0;
                 break;
                 
-            // [ (ARRAY)
-            case 91:
+            // } ] (OBJECT, ARRAY)
+            case 125:
+            case 93:
+                if (f->object != (c == 125))
+                    break;
+                
+                __json->threads = f->threads;
+                
+                if (!KEY_INTERNED(f->key))
+                    arena_free(arena_current(), f->key);
+                
+                f->key = NULL;
+                
+                if (!--depth) goto done;
                 
-                __json->arr_lev++;
-                box = new_array();
-                json_array(__json, box);
-                object_put_box(__box,
-                               MINIBOX_MEMORY_RELEASE, key,
-                               MINIBOX_MEMORY_RELEASE, box);
-                key = NULL;
-                isKey = 0;
+                f = stack + depth - 1;
                 break;
                 
             // " (STRING)
             case 34:
-            {
-                if (!isKey)
-                    key = json_string(__json);
-                else
+                if (f->object && !f->is_key)
                 {
-                    char *val = json_string(__json);
+                    if (f->path)
+                    {
+                        if (!(sub = path_key(f->path, __json->str, __json->len)))
+                        {
+                            f->skip = 1;
+                            break;
+                        }
+                        
+                        f->next = sub->leaf ? NULL : sub;
+                    }
                     
-                    object_put_string(__box,
-                                      MINIBOX_MEMORY_RELEASE, key,
-                                      MINIBOX_MEMORY_RELEASE, val);
+                    if (!KEY_INTERNED(f->key))
+                        arena_free(arena_current(), f->key);
                     
-                    key = NULL;
-                    isKey = 0;
+                    f->key = json_key(__json);
+                }
+                else if (__json->len <= VALUE_SHORT_MAX)
+                {
+                    v = box_short(__json->str, __json->len);
+                    json_put(f, &v, MINIBOX_SHORT_STRING);
+                }
+                else
+                {
+                    str = json_string(__json);
+                    json_put(f, &str, MINIBOX_TYPE_STRING + __json->vmt);
                 }
-            }
                 break;
+                
             // : (ATTRIBUTE)
             case 58:
+                if (!f->object) break;
+                
+                f->is_key = 1;
+                
+                if (f->skip)
+                {
+                    json_skip(__json, json_token(__json));
+                    f->skip = f->is_key = 0;
+                }
+                break;
+                
+            // 0<->9 - (NUMBER)
+            case 48: case 49: case 50: case 51: case 52:
+            case 53: case 54: case 55: case 56: case 57:
+            case 45:
+                if (__json->type == MINIBOX_TYPE_INTEGER)
+                    json_put(f, &__json->integer, MINIBOX_TYPE_INTEGER);
+                else
+                    json_put(f, &__json->num, MINIBOX_TYPE_NUMBER);
+                break;
+                
+            // t f (BOOLEAN)
+            case 116:
+            case 102:
+                v = c == 116;
+                json_put(f, &v, MINIBOX_TYPE_BOOLEAN);
+                break;
+                
+            // n (VNULL)
+            case 110:
+                v = 0;
+                json_put(f, &v, MINIBOX_TYPE_NULL);
+                break;
+                
+            // ',' (SEPARATOR)
+            default: break;
+        }
+    }
+    
+done:
+    __json->threads = stack[0].threads;
+    
+    while (depth-- > 0)
+        if (!KEY_INTERNED(stack[depth].key))
+            arena_free(arena_current(), stack[depth].key);
+    
+    if (stack != frames) free(stack);
+    
+    return r;
+}
+
+/*
+ * Reads the root object; tokens before its opening brace are ignored.
+ */
+int json_object(json_t *__json, box_t __box)
+{
+    int c, r = 0;
+    
+    while ((c = json_token(__json)) && c != '{');
+    
+    if (c) r = json_build(__json, __box, 1);
+    
+    free(__json->text);
+    
+    return r || __json->invalid ? -1 : 0;
+}
+
+#pragma mark - Parallel
+
+/*
+ * In parallel mode the arrays met by the main parser are first walked
+ * over the scanner's structural positions, cutting them at top level
+ * commas every JSON_PARALLEL_BLOCK bytes or so. The blocks are parsed by
+ * a pool of workers (and the main thread) into arrays of their own, which
+ * are then moved in order into the parent. Workers never split again.
+ * When the caller uses an arena each worker builds in a private one that
+ * the caller's arena retains afterwards.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    const char *source;
+    long *cuts;
+    long blocks;
+    long next;
+    box_t *parts;
+    box_t *arenas;
+    box_t keys;
+    long depth;
+    int workers;
+    int insitu;
+    int vmt;
+    int failed;
+} json_split_t;
+
+static int json_cut(json_split_t *__s, long __at)
+{
+    long *tmp;
+    
+    if (!(__s->blocks & (__s->blocks + 1)))
+    {
+        if (!(tmp = realloc(__s->cuts, (__s->blocks + 1) * 2 * sizeof(long))))
+            return -1;
+        
+        __s->cuts = tmp;
+    }
+    
+    __s->cuts[__s->blocks++] = __at;
+    
+    return 0;
+}
+
+/*
+ * The main scanner has gone over the whole array already, so blocks do
+ * not check UTF-8 again.
+ */
+static int json_block(json_split_t *__s, long __i, box_t __box)
+{
+    json_t json;
+    int r;
+    
+    json_init(&json, __s->source + __s->cuts[__i] + 1, __s->cuts[__i + 1] - __s->cuts[__i] - 1);
+    json.insitu = __s->insitu;
+    json.vmt = __s->vmt;
+    json.depth = __s->depth;
+    json.scan.utf8 = 0;
+    
+    r = json_build(&json, __box, 0);
+    free(json.text);
+    
+    return r || json.invalid ? -1 : 0;
+}
+
+static void json_blocks(json_split_t *__s)
+{
+    long i;
+    
+    for (;;)
+    {
+        pthread_mutex_lock(&__s->lock);
+        i = __s->next++;
+        pthread_mutex_unlock(&__s->lock);
+        
+        if (i >= __s->blocks - 1) return;
+        
+        if ((__s->parts[i] = new_array()) && json_block(__s, i, __s->parts[i]))
+        {
+            pthread_mutex_lock(&__s->lock);
+            __s->failed = 1;
+            pthread_mutex_unlock(&__s->lock);
+        }
+    }
+}
+
+static void* json_worker(void *__arg)
+{
+    json_split_t *s = __arg;
+    box_t arena = 0;
+    
+    keys_use(s->keys);
+    
+    if (s->arenas)
+    {
+        if (!(arena = new_arena()))
+            return NULL;
+        
+        arena_use(arena);
+        
+        pthread_mutex_lock(&s->lock);
+        s->arenas[s->workers++] = arena;
+        pthread_mutex_unlock(&s->lock);
+    }
+    
+    json_blocks(s);
+    
+    return NULL;
+}
+
+/*
+ * The blocks hold the items of an array found at __depth, so their own
+ * parsers may nest that much less.
+ */
+static int json_parallel(json_t *__json, box_t __box, long __depth)
+{
+    json_split_t s = { PTHREAD_MUTEX_INITIALIZER, __json->source, NULL, 0, 0, NULL, NULL,
+        keys_current(), __json->depth - __depth + 1, 0, __json->insitu, __json->vmt, 0 };
+    box_t arena = arena_current();
+    pthread_t threads[JSON_THREADS_MAX];
+    long i, n = 0, level = 1, last;
+    int c;
+    
+    last = __json->pointer - 1 - __json->source;
+    
+    if (json_cut(&s, last))
+        goto error;
+    
+    while (level && (c = json_next(__json)))
+    {
+        if (c == '{' || c == '[') level++;
+        else if (c == '}' || c == ']') level--;
+        else if (c == ',' && level == 1 && __json->pointer - __json->source - last > JSON_PARALLEL_BLOCK)
+        {
+            last = __json->pointer - 1 - __json->source;
+            
+            if (json_cut(&s, last))
+                goto error;
+        }
+    }
+    
+    if (__json->invalid)
+    {
+        free(s.cuts);
+        return -1;
+    }
+    
+    if (json_cut(&s, level ? __json->scan.len : __json->pointer - 1 - __json->source))
+        goto error;
+    
+    if (s.blocks == 2 || __json->threads < 2)
+    {
+        for (i = 0; i < s.blocks - 1 && !s.failed; i++)
+            s.failed = json_block(&s, i, __box);
+        
+        free(s.cuts);
+        return s.failed ? -1 : 0;
+    }
+    
+    if (!(s.parts = calloc(s.blocks - 1, sizeof(box_t))) ||
+        (arena && !(s.arenas = calloc(__json->threads, sizeof(box_t)))))
+        goto error;
+    
+    while (n < __json->threads - 1 && n < s.blocks - 2 && !pthread_create(threads + n, NULL, json_worker, &s))
+        n++;
+    
+    json_blocks(&s);
+    
+    for (i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+    
+    for (i = 0; i < s.blocks - 1; i++)
+    {
+        if (!s.parts[i]) continue;
+        
+        if (array_take(__box, s.parts[i]))
+            ERROR(BOX_MEMORY_ERROR, "json_parallel()")
+        
+        free_box(s.parts[i]);
+    }
+    
+    for (i = 0; i < s.workers; i++)
+        arena_retain(arena, s.arenas[i]);
+    
+    free(s.arenas);
+    free(s.parts);
+    free(s.cuts);
+    pthread_mutex_destroy(&s.lock);
+    return s.failed ? -1 : 0;
+    
+error:
+    ERROR(BOX_MEMORY_ERROR, "json_parallel()")
+    free(s.parts);
+    free(s.cuts);
+    return -1;
+}
+
+/*
+ * Parses with up to __threads threads (one per online processor when
+ * zero or less), splitting large arrays between them.
+ */
+box_t object_from_json_string_parallel(const char *__src, int __threads)
+{
+    box_t obj = new_object();
+    json_t json;
+    
+    if (__threads <= 0) __threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (__threads > JSON_THREADS_MAX) __threads = JSON_THREADS_MAX;
+    
+    if (!obj) return 0;
+    
+    json_init(&json, __src, strlen(__src));
+    json.threads = __threads > 1 ? __threads : 0;
+    
+    if (json_object(&json, obj))
+    {
+        free_box(obj);
+        obj = 0;
+    }
+    
+    return obj;
+}
+
+box_t object_from_json_file_parallel(const char *__path, int __threads)
+{
+    box_t str, box;
+    
+    if (!(str = stream_load(__path)))
+        return 0;
+    
+    box = object_from_json_string_parallel(box_buffer(str), __threads);
+    
+    free_box(str);
+    
+    return box;
+}
+
+#pragma mark - Push
+
+#define JSON_FORMAT_ERROR "Invalid json format."
+#define JSON_SCALAR(c) (((c) >= '0' && (c) <= '9') || ((c) >= 'a' && (c) <= 'z') || \
+    (c) == '-' || (c) == '+' || (c) == '.' || (c) == 'E')
+
+/*
+ * A push parser builds one document at a time from chunks of any size.
+ * Its state is kept explicitly between feeds: the open containers, the
+ * key waiting for its value, and the bytes of a string, number or literal
+ * cut by the end of a chunk. Tokens that end inside the chunk they start
+ * in are read straight from it. The tree is built in the arena, under the
+ * depth limit and with the UTF-8 checking that were in effect when the
+ * parser was created; strings are decoded in the token buffer.
+ */
+enum {
+    PUSH_START,
+    PUSH_KEY,
+    PUSH_KEY_OR_END,
+    PUSH_COLON,
+    PUSH_VALUE,
+    PUSH_VALUE_OR_END,
+    PUSH_NEXT,
+    PUSH_STRING,
+    PUSH_SCALAR,
+    PUSH_DONE,
+    PUSH_ERROR
+};
+
+typedef struct
+{
+    box_t arena;
+    box_t root;
+    box_t *stack;
+    long depth;
+    long max;
+    long limit;
+    char *key;
+    char *buf;
+    long len;
+    long size;
+    int state;
+    int escaped;
+    int is_key;
+    int utf8;
+} json_push_t;
+
+box_t new_json_parser(void)
+{
+    long *box;
+    json_push_t *p;
+    
+    if (!(box = malloc(BOX_HEADER)) || !(p = calloc(1, sizeof(json_push_t))))
+    {
+        ERROR(BOX_MEMORY_ERROR, "new_json_parser()")
+        free(box);
+        return 0;
+    }
+    
+    p->arena = arena_current();
+    p->limit = depth_current();
+    p->utf8 = utf8_current();
+    p->state = PUSH_START;
+    
+    box[0] = (long) p;
+    box[1] = 0;
+    box[2] = MINIBOX_TYPE_PARSER;
+    box[3] = 0;
+    box[4] = 0;
+    box[5] = 0;
+    box[6] = 0;
+    
+    return (box_t) box;
+}
+
+static int json_push_append(json_push_t *__p, const char *__src, long __len)
+{
+    char *tmp;
+    long size = __p->size;
+    
+    while (size < __p->len + __len + 1) size = size * 2 + 0x40;
+    
+    if (size != __p->size)
+    {
+        if (!(tmp = realloc(__p->buf, size)))
+            return -1;
+        
+        __p->buf = tmp;
+        __p->size = size;
+    }
+    
+    memcpy(__p->buf + __p->len, __src, __len);
+    __p->len += __len;
+    __p->buf[__p->len] = 0;
+    
+    return 0;
+}
+
+static void json_push_discard(json_push_t *__p)
+{
+    if (__p->root) free_box(__p->root);
+    if (__p->key && !KEY_INTERNED(__p->key)) arena_free(__p->arena, __p->key);
+    
+    __p->root = 0;
+    __p->key = NULL;
+    __p->depth = 0;
+    __p->len = 0;
+    __p->state = PUSH_START;
+}
+
+static int json_push_value(json_push_t *__p, const void *__value, long __type)
+{
+    box_t top = __p->stack[__p->depth - 1];
+    
+    if (box_type(top) == MINIBOX_TYPE_ARRAY)
+        array_add(top, __value, __type);
+    else
+        object_put(top, __p->key, MINIBOX_MEMORY_RELEASE, __value, __type);
+    
+    __p->key = NULL;
+    __p->state = PUSH_NEXT;
+    
+    return 0;
+}
+
+static int json_push_open(json_push_t *__p, int __c)
+{
+    box_t *tmp, box = __c == '{' ? new_object() : new_array();
+    
+    if (!box) return -1;
+    
+    if (__p->depth == __p->limit)
+    {
+        ERROR(BOX_DEPTH_ERROR, "json_push_open()")
+        free_box(box);
+        return -1;
+    }
+    
+    if (__p->depth == __p->max)
+    {
+        if (!(tmp = realloc(__p->stack, (__p->max * 2 + 0x10) * sizeof(box_t))))
+        {
+            free_box(box);
+            return -1;
+        }
+        
+        __p->stack = tmp;
+        __p->max = __p->max * 2 + 0x10;
+    }
+    
+    if (__p->depth)
+        json_push_value(__p, &box, box_type(box) + MINIBOX_MEMORY_RELEASE);
+    else
+        __p->root = box;
+    
+    __p->stack[__p->depth++] = box;
+    __p->state = __c == '{' ? PUSH_KEY_OR_END : PUSH_VALUE_OR_END;
+    
+    return 0;
+}
+
+static int json_push_close(json_push_t *__p, int __c)
+{
+    if (box_type(__p->stack[__p->depth - 1]) != (__c == '}' ? MINIBOX_TYPE_OBJECT : MINIBOX_TYPE_ARRAY))
+        return -1;
+    
+    __p->state = --__p->depth ? PUSH_NEXT : PUSH_DONE;
+    
+    return 0;
+}
+
+static int json_push_string(json_push_t *__p, const char *__str, long __len)
+{
+    box_t keys = keys_current();
+    value_t v;
+    char *str;
+    
+    if (memchr(__str, '\\', __len))
+    {
+        if (__str != __p->buf && json_push_append(__p, __str, __len))
+            return -1;
+        
+        if ((__len = json_unescape(__p->buf, __p->buf, __len)) < 0)
+            return -1;
+        
+        __str = __p->buf;
+    }
+    
+    if (__p->utf8 && utf8_check(__str, __len))
+        return -1;
+    
+    if (__p->is_key)
+    {
+        __p->key = keys ? keys_intern(keys, __str, __len) : json_copy(__str, __len);
+        __p->state = PUSH_COLON;
+        
+        return __p->key ? 0 : -1;
+    }
+    
+    if (__len <= VALUE_SHORT_MAX)
+    {
+        v = box_short(__str, __len);
+        return json_push_value(__p, &v, MINIBOX_SHORT_STRING);
+    }
+    
+    if (!(str = json_copy(__str, __len)))
+        return -1;
+    
+    return json_push_value(__p, &str, MINIBOX_TPAR_STRING);
+}
+
+static int json_push_scalar(json_push_t *__p, const char *__src, long __len)
+{
+    long integer, b = 1;
+    double num;
+    
+    switch (*__src)
+    {
+        case 't':
+        case 'f':
+            if (__len != (*__src == 't' ? 4 : 5) || memcmp(__src, *__src == 't' ? "true" : "false", __len))
+                return -1;
+            
+            b = *__src == 't';
+            return json_push_value(__p, &b, MINIBOX_TYPE_BOOLEAN);
+            
+        case 'n':
+            if (__len != 4 || memcmp(__src, "null", 4))
+                return -1;
+            
+            return json_push_value(__p, &b, MINIBOX_TYPE_NULL);
+            
+        default: break;
+    }
+    
+    if (number_integer(__src, &integer) == __len)
+        return json_push_value(__p, &integer, MINIBOX_TYPE_INTEGER);
+    
+    if (number_parse(__src, &num) == __len)
+        return json_push_value(__p, &num, MINIBOX_TYPE_NUMBER);
+    
+    return -1;
+}
+
+static int json_push_char(json_push_t *__p, int __c)
+{
+    switch (__p->state)
+    {
+        case PUSH_START:
+            return __c == '{' ? json_push_open(__p, __c) : -1;
+            
+        case PUSH_KEY_OR_END:
+            if (__c == '}') return json_push_close(__p, __c);
+            /* fall through */
+        case PUSH_KEY:
+            if (__c != '"') return -1;
+            
+            __p->is_key = 1;
+            __p->state = PUSH_STRING;
+            return 0;
+            
+        case PUSH_COLON:
+            if (__c != ':') return -1;
+            
+            __p->state = PUSH_VALUE;
+            return 0;
+            
+        case PUSH_VALUE_OR_END:
+            if (__c == ']') return json_push_close(__p, __c);
+            /* fall through */
+        case PUSH_VALUE:
+            if (__c == '{' || __c == '[')
+                return json_push_open(__p, __c);
+            
+            if (__c == '"')
+            {
+                __p->is_key = 0;
+                __p->state = PUSH_STRING;
+                return 0;
+            }
+            
+            if (!JSON_SCALAR(__c)) return -1;
+            
+            __p->state = PUSH_SCALAR;
+            return 0;
+            
+        case PUSH_NEXT:
+            if (__c == '}' || __c == ']')
+                return json_push_close(__p, __c);
+            
+            if (__c != ',') return -1;
+            
+            __p->state = box_type(__p->stack[__p->depth - 1]) == MINIBOX_TYPE_ARRAY ?
+                PUSH_VALUE : PUSH_KEY;
+            return 0;
+            
+        default: return -1;
+    }
+}
+
+/*
+ * Reads the chunk up to the end of the current document and returns the
+ * number of bytes used, or -1 on malformed input. The rest of the chunk
+ * belongs to the next document, once this one has been taken.
+ */
+long json_parser_feed(box_t __box, const char *__chunk, long __len)
+{
+    json_push_t *p = BOXB;
+    const char *s = __chunk, *e = __chunk + __len, *q;
+    box_t arena = arena_use(p->arena);
+    int r = 0;
+    
+    while (s < e && !r && p->state != PUSH_DONE && p->state != PUSH_ERROR)
+    {
+        switch (p->state)
+        {
+            case PUSH_STRING:
+                for (q = s; q < e; q++)
+                {
+                    if (p->escaped)
+                    {
+                        p->escaped = 0;
+                        continue;
+                    }
+                    
+                    if ((q += scan_string(q, e - q)) == e || *q == '"')
+                        break;
+                    
+                    p->escaped = 1;
+                }
+                
+                if (q == e || p->len)
+                    r = json_push_append(p, s, q - s);
+                
+                if (q < e && !r)
+                {
+                    r = p->len ? json_push_string(p, p->buf, p->len) : json_push_string(p, s, q - s);
+                    p->len = 0;
+                    q++;
+                }
+                
+                s = q;
+                break;
+                
+            case PUSH_SCALAR:
+                for (q = s; q < e && JSON_SCALAR(*q); q++);
+                
+                if (q == e || p->len)
+                    r = json_push_append(p, s, q - s);
+                
+                if (q < e && !r)
+                {
+                    r = p->len ? json_push_scalar(p, p->buf, p->len) : json_push_scalar(p, s, q - s);
+                    p->len = 0;
+                }
                 
-                isKey = 1;
+                s = q;
                 break;
                 
-            // 0<->9 (NUMBER)
-            case 48: case 49: case 50: case 51: case 52:
-            case 53: case 54: case 55: case 56: case 57:
-            // - (NUMBER)
-            case 45:
+            default:
+                if (*s == ' ' || *s == '\n' || *s == '\r' || *s == '\t')
+                {
+                    s++;
+                    break;
+                }
+                
+                if (!(r = json_push_char(p, *s)) && p->state != PUSH_SCALAR)
+                    s++;
+                break;
+        }
+    }
+    
+    arena_use(arena);
+    
+    if (r || p->state == PUSH_ERROR)
+    {
+        if (p->state != PUSH_ERROR)
+            ERROR(JSON_FORMAT_ERROR, "json_parser_feed()")
+        
+        p->state = PUSH_ERROR;
+        return -1;
+    }
+    
+    return s - __chunk;
+}
+
+/*
+ * Hands over the document once it is complete and gets the parser ready
+ * for the next one; returns 0 while it is still incomplete. After an
+ * error the partial document is dropped and the parser is reset.
+ */
+box_t json_parser_take(box_t __box)
+{
+    json_push_t *p = BOXB;
+    box_t root = p->root;
+    
+    if (p->state == PUSH_ERROR)
+    {
+        json_push_discard(p);
+        return 0;
+    }
+    
+    if (p->state != PUSH_DONE)
+        return 0;
+    
+    p->root = 0;
+    p->state = PUSH_START;
+    
+    return root;
+}
+
+void json_parser_release(box_t __box)
+{
+    json_push_t *p = BOXB;
+    
+    json_push_discard(p);
+    
+    free(p->stack);
+    free(p->buf);
+    free(p);
+    free((void *) __box);
+}
+
+#pragma mark - Events
+
+#define JSON_EVENTS_DEPTH 0x400
+#define JSON_EVENT(f, ...) (__events->f ? __events->f(__ctx, ##__VA_ARGS__) : 0)
+
+/*
+ * The event and lazy parsers keep their open containers on a stack of
+ * JSON_EVENTS_DEPTH levels on the C stack and double it on the heap past
+ * that, like box_stack_t, so depth_use() is their only limit. Returns the
+ * new stack, or NULL leaving __stack as it was.
+ */
+static void* json_grow(void *__stack, const void *__frames, long *__size, long __width)
+{
+    void *tmp;
+    
+    if (!(tmp = malloc(*__size * 2 * __width)))
+    {
+        ERROR(BOX_MEMORY_ERROR, "json_grow()")
+        return NULL;
+    }
+    
+    memcpy(tmp, __stack, *__size * __width);
+    if (__stack != __frames) free(__stack);
+    
+    *__size *= 2;
+    
+    return tmp;
+}
+
+/*
+ * Walks the document through the tokenizer without building any box,
+ * reporting every token to the handler. Strings are decoded views that
+ * are not terminated and only last until the callback returns. A non
+ * zero value returned by a callback stops the walk and is returned; -1
+ * means malformed input.
+ */
+static int json_events(json_t *__json, const json_events_t *__events, void *__ctx)
+{
+    unsigned long frames[JSON_EVENTS_DEPTH / 64], *object = frames, *tmp;
+    long depth = 0, words = JSON_EVENTS_DEPTH / 64, max = depth_current();
+    int key = 0;
+    int r = 0;
+    int c;
+    
+    while ((c = json_token(__json)))
+    {
+        switch (c)
+        {
+            case '{':
+            case '[':
+                if (depth == max)
+                {
+                    r = -1;
+                    goto done;
+                }
                 
-                if (isKey)
+                if (depth / 64 == words)
                 {
-                    double num = json_number(__json);
-                    object_put_number(__box,
-                                      MINIBOX_MEMORY_RELEASE, key,
-                                      num);
-                    key = NULL;
-                    isKey = 0;
+                    if (!(tmp = json_grow(object, frames, &words, sizeof(unsigned long))))
+                    {
+                        r = -1;
+                        goto done;
+                    }
+                    
+                    object = tmp;
                 }
                 
+                if (c == '{')
+                    object[depth / 64] |= 1UL << (depth % 64);
+                else
+                    object[depth / 64] &= ~(1UL << (depth % 64));
+                
+                depth++;
+                key = c == '{';
+                r = c == '{' ? JSON_EVENT(start_object) : JSON_EVENT(start_array);
                 break;
-            // t (BOOLEAN)
-            case 116:
                 
-                if (isKey)
+            case '}':
+            case ']':
+                if (!depth--)
                 {
-                    long num = 1;
-                    object_put_boolean(__box,
-                                       MINIBOX_MEMORY_RELEASE, key,
-                                       num);
-                    key = NULL;
-                    isKey = 0;
+                    r = -1;
+                    goto done;
+                }
+                
+                key = 0;
+                r = c == '}' ? JSON_EVENT(end_object) : JSON_EVENT(end_array);
+                
+                if (!depth)
+                    goto done;
+                break;
+                
+            case ',':
+                key = depth && (object[(depth - 1) / 64] >> ((depth - 1) % 64) & 1);
+                break;
+                
+            case '"':
+                if (key)
+                    r = JSON_EVENT(key, __json->str, __json->len);
+                else
+                    r = JSON_EVENT(string, __json->str, __json->len);
+                key = 0;
+                break;
+                
+            case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+            case '-':
+                if (__json->type == MINIBOX_TYPE_NUMBER)
+                    r = JSON_EVENT(number, __json->num);
+                else if (__events->integer)
+                    r = JSON_EVENT(integer, __json->integer);
+                else
+                    r = JSON_EVENT(number, (double) __json->integer);
+                break;
+                
+            case 't': r = JSON_EVENT(boolean, 1); break;
+            case 'f': r = JSON_EVENT(boolean, 0); break;
+            case 'n': r = JSON_EVENT(null); break;
+                
+            // : (ATTRIBUTE)
+            default: break;
+        }
+        
+        if (r) goto done;
+    }
+    
+    r = depth ? -1 : 0;
+    
+done:
+    if (object != frames) free(object);
+    
+    return r;
+}
+
+int json_parse_events(const char *__src, const json_events_t *__events, void *__ctx)
+{
+    json_t json;
+    int r;
+    
+    json_init(&json, __src, strlen(__src));
+    
+    if (!(r = json_events(&json, __events, __ctx)) && json.invalid)
+        r = -1;
+    
+    free(json.text);
+    
+    return r;
+}
+
+int json_parse_file_events(const char *__path, const json_events_t *__events, void *__ctx)
+{
+    box_t str;
+    json_t json;
+    int r;
+    
+    if (!(str = stream_load(__path)))
+        return -1;
+    
+    json_init(&json, box_buffer(str), box_size(str) - 1);
+    
+    if (!(r = json_events(&json, __events, __ctx)) && json.invalid)
+        r = -1;
+    
+    free(json.text);
+    free_box(str);
+    
+    return r;
+}
+
+#pragma mark - Lazy
+
+/*
+ * A lazy document keeps the source and a tape with one entry per
+ * structural position (at), where brackets also hold the entry of their
+ * match (end). Containers are created empty with BOXM at BOX_LAZY and
+ * their tape entry in the buffer; json_load() fills one level in when
+ * the container is first touched, leaving nested containers lazy, so
+ * only the paths actually read are ever built. Strings and keys are
+ * decoded and terminated in place as in object_from_json_stream(); since
+ * a loaded container cannot fail, a malformed escape is left as it is.
+ */
+
+typedef struct
+{
+    unsigned at;
+    unsigned end;
+} tape_t;
+
+typedef struct
+{
+    char *src;
+    const tape_t *tape;
+    long pos;
+} lazy_t;
+
+typedef union
+{
+    double number;
+    long integer;
+    long boolean;
+    char *string;
+    box_t box;
+    value_t slot;
+} json_value_t;
+
+static box_t json_lazy(char *__src, const tape_t *__tape, long __pos)
+{
+    box_t __box = __src[__tape[__pos].at] == '{' ? new_object() : new_array();
+    lazy_t *lazy;
+    
+    if (!__box) return 0;
+    
+    lazy = BOXB;
+    lazy->src = __src;
+    lazy->tape = __tape;
+    lazy->pos = __pos;
+    ((long *) __box)[3] = BOX_LAZY;
+    
+    return __box;
+}
+
+static tape_t* json_tape(box_t __arena, const char *__src, long __len)
+{
+    long i, n, count = 0, size = JSON_INDEX, depth = 0, frames[JSON_EVENTS_DEPTH], *stack = frames;
+    long levels = JSON_EVENTS_DEPTH, max = depth_current();
+    long index[JSON_INDEX];
+    tape_t *tape, *tmp;
+    scan_t scan;
+    void *grown;
+    char c;
+    
+    if (__len >= 0xFFFFFFFFL || !(tape = arena_alloc(__arena, size * sizeof(tape_t))))
+        return NULL;
+    
+    scan_init(&scan, __src, __len);
+    
+    while ((n = scan_json(&scan, index, JSON_INDEX)))
+    {
+        if (count + n > size)
+        {
+            if (!(tmp = arena_realloc(__arena, tape, size * sizeof(tape_t), size * 2 * sizeof(tape_t))))
+                goto fail;
+            
+            tape = tmp;
+            size *= 2;
+        }
+        
+        for (i = 0; i < n; i++, count++)
+        {
+            tape[count].at = (unsigned) index[i];
+            tape[count].end = 0;
+            
+            switch ((c = __src[index[i]]))
+            {
+                case '{': case '[':
+                    if (depth == max) goto fail;
+                    
+                    if (depth == levels)
+                    {
+                        if (!(grown = json_grow(stack, frames, &levels, sizeof(long))))
+                            goto fail;
+                        
+                        stack = grown;
+                    }
+                    
+                    stack[depth++] = count;
+                    break;
+                    
+                case '}': case ']':
+                    if (!depth || __src[tape[stack[depth - 1]].at] != c - 2)
+                        goto fail;
+                    tape[stack[--depth]].end = (unsigned) count;
+                    break;
+                    
+                default: break;
+            }
+        }
+    }
+    
+    if (depth || !count || scan.invalid || __src[tape[0].at] != '{')
+        goto fail;
+    
+    if (stack != frames) free(stack);
+    
+    return tape;
+    
+fail:
+    if (stack != frames) free(stack);
+    
+    return NULL;
+}
+
+/*
+ * Takes ownership of the stream like object_from_json_stream() and
+ * returns a lazy root object, or 0 if the brackets do not balance or the
+ * document is not an object.
+ */
+box_t object_from_json_lazy(box_t __stream)
+{
+    box_t obj = 0, own = 0;
+    box_t arena = arena_current();
+    char *src = box_buffer(__stream);
+    tape_t *tape;
+    
+    if (stream_writable(__stream) || (!arena && !(arena = own = new_arena())))
+    {
+        ERROR(BOX_CREATE_ERROR, "object_from_json_lazy()")
+        free_box(__stream);
+        return 0;
+    }
+    
+    arena_retain(arena, __stream);
+    arena_use(arena);
+    
+    if (!(tape = json_tape(arena, src, strlen(src))))
+        ERROR(BOX_CREATE_ERROR, "object_from_json_lazy()")
+    else
+        obj = json_lazy(src, tape, 0);
+    
+    if (own)
+    {
+        arena_use(0);
+        
+        if (obj) box_link(obj, own);
+        else free_box(own);
+    }
+    
+    return obj;
+}
+
+void json_load(box_t __box)
+{
+    lazy_t lazy = *(lazy_t *) BOXB;
+    const tape_t *tape = lazy.tape;
+    box_t prev = arena_use(BOXA);
+    long i, type, end = tape[lazy.pos].end;
+    int object = BOXT == MINIBOX_TYPE_OBJECT;
+    char *key = NULL, *p;
+    json_value_t value;
+    json_t json;
+    
+    ((long *) __box)[3] = 32;
+    json.insitu = 1;
+    json.text = NULL;
+    json.size = 0;
+    
+    for (i = lazy.pos + 1; i < end; i++)
+    {
+        p = lazy.src + tape[i].at;
+        
+        switch (*p)
+        {
+            case '"':
+                json.str = p + 1;
+                json.len = tape[i + 1].at - tape[i].at - 1;
+                i++;
+                
+                if (memchr(json.str, '\\', json.len))
+                {
+                    json.insitu = 0;
+                    
+                    if (!json_decode(&json))
+                    {
+                        memcpy(p + 1, json.str, json.len);
+                        json.str = p + 1;
+                    }
+                    
+                    json.insitu = 1;
+                }
+                
+                if (object && !key)
+                {
+                    key = json_key(&json);
+                    continue;
+                }
+                
+                if (json.len <= VALUE_SHORT_MAX)
+                {
+                    value.slot = box_short(json.str, json.len);
+                    type = MINIBOX_SHORT_STRING;
+                }
+                else
+                {
+                    value.string = json_string(&json);
+                    type = MINIBOX_TYPE_STRING;
                 }
                 break;
-            // f (BOOLEAN)
-            case 102:
                 
-                if (isKey)
+            case '{': case '[':
+                if (!(value.box = json_lazy(lazy.src, tape, i)))
                 {
-                    long num = 0;
-                    object_put_boolean(__box,
-                                       MINIBOX_MEMORY_RELEASE, key,
-                                       num);
-                    key = NULL;
-                    isKey = 0;
+                    ERROR(BOX_MEMORY_ERROR, "json_load()")
+                    if (key && !KEY_INTERNED(key)) arena_free(BOXA, key);
+                    goto done;
                 }
+                
+                type = box_type(value.box) + MINIBOX_MEMORY_RELEASE;
+                i = tape[i].end;
+                break;
+                
+            case 't': case 'f':
+                value.boolean = *p == 't';
+                type = MINIBOX_TYPE_BOOLEAN;
+                break;
+                
+            case 'n':
+                value.boolean = 0;
+                type = MINIBOX_TYPE_NULL;
                 break;
-            // n (VNULL)
-            case 110:
                 
-                if (isKey)
+            case '-': case '0': case '1': case '2': case '3': case '4':
+            case '5': case '6': case '7': case '8': case '9':
+                if (number_integer(p, &value.integer))
+                    type = MINIBOX_TYPE_INTEGER;
+                else
                 {
-                    object_put_null(__box,
-                                    MINIBOX_MEMORY_RELEASE, key);
-                    key = NULL;
-                    isKey = 0;
+                    number_parse(p, &value.number);
+                    type = MINIBOX_TYPE_NUMBER;
                 }
                 break;
                 
-            // '\t' '\n' ' ' ',' (USELESS)
-            default: break;
+            default: continue;
+        }
+        
+        if (!object)
+            array_add(__box, &value, type);
+        else if (key)
+            object_put(__box, key, MINIBOX_MEMORY_RELEASE, &value, type);
+        
+        key = NULL;
+    }
+    
+done:
+    free(json.text);
+    arena_use(prev);
+}
+
+#pragma mark - Serialize
+
+/*
+ * The writers walk the tree over an explicit stack of frames, each a
+ * container and the offset of its next slot, so trees as deep as
+ * depth_use() lets the parsers build are written without exhausting the
+ * thread stack. Frames live on the C stack until BOX_FRAMES are in use.
+ */
+typedef struct
+{
+    char *slots;
+    long size;
+    long i;
+    int object;
+} json_out_t;
+
+typedef struct
+{
+    json_out_t *frame;
+    long count;
+    long size;
+} json_writer_t;
+
+static json_out_t* json_out_push(json_writer_t *__w, box_t __box)
+{
+    json_out_t *f;
+    
+    if (__w->count == __w->size)
+    {
+        if (!(f = malloc(__w->size * 2 * sizeof(json_out_t))))
+        {
+            ERROR(BOX_MEMORY_ERROR, "json_out_push()")
+            return NULL;
         }
         
-    } while (*__json->pointer != '\0');
+        memcpy(f, __w->frame, __w->count * sizeof(json_out_t));
+        if (__w->size > BOX_FRAMES) free(__w->frame);
+        
+        __w->frame = f;
+        __w->size *= 2;
+    }
+    
+    BOX_LOAD(__box);
+    
+    f = __w->frame + __w->count++;
+    f->slots = BOXB;
+    f->size = BOXS;
+    f->i = 0;
+    f->object = (BOXT | MINIBOX_MEMORY_RELEASE) == MINIBOX_TPAR_OBJECT;
+    
+    return f;
+}
+
+static void json_put_string(box_t __str, value_t __value)
+{
+    stream_add_json_string(__str, VALUE_STRING(__value), -1);
 }
 
-void array_json(box_t __box, box_t __str, int *level);
+static void json_put_key(box_t __str, char *__key)
+{
+    stream_add_json_string(__str, KEY_STR(__key), KEY_SIZE(__key));
+}
 
-static void json_put_value(box_t __str, long __type, void *__value, int *__level)
+/*
+ * Writes a scalar, or returns the container to descend into.
+ */
+static box_t json_put_value(box_t __str, value_t __value, int *__level)
 {
-    switch (__type)
+    switch (VALUE_TYPE(__value))
     {
         case MINIBOX_TYPE_STRING:
         case MINIBOX_TPAR_STRING:
-            stream_add_between(__str, *((char **) __value), '"');
+        case MINIBOX_SHORT_STRING:
+            json_put_string(__str, __value);
             break;
             
         case MINIBOX_TYPE_ARRAY:
         case MINIBOX_TPAR_ARRAY:
-            array_json(*(box_t *)__value, __str, __level);
-            break;
-        
         case MINIBOX_TYPE_OBJECT:
         case MINIBOX_TPAR_OBJECT:
-            object_json(*(box_t *)__value, __str, __level);
-            break;
+            return (box_t) VALUE_PTR(__value);
             
-        default: box_put_value(__str, __type, __value, __level);
+        default: box_put_value(__str, __value, __level);
     }
+    
+    return 0;
 }
 
-void array_json(box_t __box, box_t __str, int *level)
+#pragma mark - Pretty
+
+void object_json(box_t __box, box_t __str, int *level)
 {
-    long i;
+    json_out_t frames[BOX_FRAMES], *f;
+    json_writer_t w = { frames, 0, BOX_FRAMES };
+    char *slot;
     
-    stream_open_hierarchy(__str, '[', (*level += 1));
-    
-    for (i = 0; i < BOXS; i += V2S)
+    while (__box && (f = json_out_push(&w, __box)))
     {
-        void *value = BOXB + i + MINIBOX_VALUE;
-        long type  = *(long*) (BOXB + i + MINIBOX_TYPE );
+        stream_open_hierarchy(__str, f->object ? '{' : '[', (*level += 1));
         
-        if (i != 0) stream_add(__str, ", ");
-        json_put_value(__str, type, value, level);
+        for (__box = 0; !__box && w.count; )
+        {
+            f = w.frame + w.count - 1;
+            slot = f->slots + f->i;
+            
+            if (f->i == f->size)
+            {
+                stream_close_hierarchy(__str, f->object ? '}' : ']', (*level -= 1));
+                w.count--;
+            }
+            else if (f->object)
+            {
+                if (f->i) stream_open_hierarchy(__str, ',', *level);
+                
+                json_put_key(__str, *(char **) (slot + MINIBOX_KEY));
+                stream_add(__str, " : ");
+                
+                f->i += V2S;
+                __box = json_put_value(__str, SLOT(slot + MINIBOX_VALUE), level);
+            }
+            else
+            {
+                if (f->i) stream_add(__str, ", ");
+                
+                f->i += V1S;
+                __box = json_put_value(__str, SLOT(slot), level);
+            }
+        }
     }
     
-    stream_close_hierarchy(__str, ']', (*level -= 1));
+    if (w.size > BOX_FRAMES) free(w.frame);
 }
 
-void object_json(box_t __box, box_t __str, int *level)
+#pragma mark - Compact
+
+void object_json_compact(box_t __box, box_t __str)
 {
-    long i;
+    json_out_t frames[BOX_FRAMES], *f;
+    json_writer_t w = { frames, 0, BOX_FRAMES };
+    char *slot;
     
-    stream_open_hierarchy(__str, '{', (*level += 1));
-    
-    for (i = 0; i < BOXS; i += V3S)
+    while (__box && (f = json_out_push(&w, __box)))
     {
-        void *value = (BOXB + i + MINIBOX_VALUE);
-        long type  = *(long *) (BOXB + i + MINIBOX_TYPE );
-        char *key = *(char **) (BOXB + i + MINIBOX_KEY  );
-    
-        if (i != 0) stream_open_hierarchy(__str, ',', *level);
+        stream_add_char(__str, f->object ? '{' : '[');
         
-        stream_add_between(__str, key, '"');
-        stream_add(__str, " : ");
-        json_put_value(__str, type, value, level);
+        for (__box = 0; !__box && w.count; )
+        {
+            f = w.frame + w.count - 1;
+            slot = f->slots + f->i;
+            
+            if (f->i == f->size)
+            {
+                stream_add_char(__str, f->object ? '}' : ']');
+                w.count--;
+            }
+            else if (f->object)
+            {
+                if (f->i) stream_add_char(__str, ',');
+                
+                json_put_key(__str, *(char **) (slot + MINIBOX_KEY));
+                stream_add_char(__str, ':');
+                
+                f->i += V2S;
+                __box = json_put_value(__str, SLOT(slot + MINIBOX_VALUE), NULL);
+            }
+            else
+            {
+                if (f->i) stream_add_char(__str, ',');
+                
+                f->i += V1S;
+                __box = json_put_value(__str, SLOT(slot), NULL);
+            }
+        }
     }
     
-    stream_close_hierarchy(__str, '}', (*level -= 1));
+    if (w.size > BOX_FRAMES) free(w.frame);
 }
@@ -0,0 +1,182 @@
+//
+//  keys.c
+//  minibox
+//
+//  Created by Antonio Angel Martínez Domínguez on 1/6/19.
+//
+//  Copyright 2019 Rokit Systems
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "box.h"
+
+#define KEYS_MIN 0x400
+
+/*
+ * A key table hands out one copy of every key it is asked for. Entries
+ * are bumped out of a private arena, preceded by their hash, and the
+ * pointers handed out carry KEY_TAG so objects can tell them apart from
+ * keys they own. The table is shared under its mutex, so one table can
+ * serve a single document or every thread of the process.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    box_t arena;
+    long mask;
+    char **slots;
+} keys_t;
+
+static __thread box_t keys_active = 0;
+
+box_t new_keys(void)
+{
+    long *box;
+    keys_t *k;
+
+    if (!(box = malloc(BOX_HEADER)) || !(k = malloc(sizeof(keys_t))))
+    {
+        ERROR(BOX_MEMORY_ERROR, "new_keys()")
+        free(box);
+        return 0;
+    }
+
+    k->mask = KEYS_MIN - 1;
+    k->arena = new_arena();
+    k->slots = calloc(KEYS_MIN, sizeof(char *));
+
+    if (!k->arena || !k->slots)
+    {
+        ERROR(BOX_MEMORY_ERROR, "new_keys()")
+        if (k->arena) free_box(k->arena);
+        free(k->slots);
+        free(k);
+        free(box);
+        return 0;
+    }
+
+    pthread_mutex_init(&k->lock, NULL);
+
+    box[0] = (long) k;
+    box[1] = 0;
+    box[2] = MINIBOX_TYPE_KEYS;
+    box[3] = 0;
+    box[4] = 0;
+    box[5] = 0;
+    box[6] = 0;
+
+    return (long) box;
+}
+
+box_t keys_use(box_t __box)
+{
+    box_t prev = keys_active;
+    keys_active = __box;
+    return prev;
+}
+
+box_t keys_current(void)
+{
+    return keys_active;
+}
+
+static int keys_grow(keys_t *__k)
+{
+    long i, j, mask = __k->mask * 2 + 1;
+    char **slots;
+
+    if (!(slots = calloc(mask + 1, sizeof(char *))))
+        return -1;
+
+    for (i = 0; i <= __k->mask; i++)
+    {
+        if (!__k->slots[i]) continue;
+
+        for (j = KEY_HASH(__k->slots[i]) & mask; slots[j]; j = (j + 1) & mask);
+
+        slots[j] = __k->slots[i];
+    }
+
+    free(__k->slots);
+    __k->slots = slots;
+    __k->mask = mask;
+
+    return 0;
+}
+
+char* keys_intern(box_t __box, const char *__str, long __len)
+{
+    keys_t *k = BOXB;
+    unsigned hash = object_hash_len(__str, __len);
+    unsigned *head;
+    char *key = NULL;
+    long i;
+
+    pthread_mutex_lock(&k->lock);
+
+    for (i = hash & k->mask; k->slots[i]; i = (i + 1) & k->mask)
+    {
+        key = k->slots[i];
+
+        if (KEY_HASH(key) == hash && KEY_LENGTH(key) == __len &&
+            !memcmp(key, __str, __len))
+            goto found;
+    }
+
+    if ((BOXS + 1) * 2 > k->mask + 1)
+    {
+        if (keys_grow(k)) goto fail;
+
+        for (i = hash & k->mask; k->slots[i]; i = (i + 1) & k->mask);
+    }
+
+    if (!(head = arena_alloc(k->arena, 2 * sizeof(unsigned) + __len + 1)))
+        goto fail;
+
+    head[0] = hash;
+    head[1] = (unsigned) __len;
+    key = (char *) (head + 2);
+    memcpy(key, __str, __len);
+    key[__len] = '\0';
+
+    k->slots[i] = key;
+    ((long *) __box)[1] += 1;
+
+found:
+    pthread_mutex_unlock(&k->lock);
+    return (char *) ((unsigned long) key | KEY_TAG);
+
+fail:
+    pthread_mutex_unlock(&k->lock);
+    ERROR(BOX_MEMORY_ERROR, "keys_intern()")
+    return NULL;
+}
+
+void keys_release(box_t __box)
+{
+    keys_t *k = BOXB;
+
+    if (keys_active == __box)
+        keys_active = 0;
+
+    pthread_mutex_destroy(&k->lock);
+    free_box(k->arena);
+    free(k->slots);
+    free(k);
+    free((void *) __box);
+}
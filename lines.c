@@ -0,0 +1,389 @@
+//
+//  lines.c
+//  minibox
+//
+//  Created by Antonio Angel Martínez Domínguez on 1/6/19.
+//
+//  Copyright 2019 Rokit Systems
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "box.h"
+
+#define LINES_CHUNK 0x100000
+#define LINES_THREADS_MAX 0x100
+
+/*
+ * A JSON Lines reader owns the loaded stream and a pool of workers. Each
+ * worker claims the next chunk of about LINES_CHUNK bytes, cut after a
+ * newline, terminates its lines in place and parses them into a slot.
+ * There are two slots per worker, so workers never run further ahead of
+ * the reader than that. Slots are handed back in claim order, or as soon
+ * as they are done with MINIBOX_ORDER_ANY. Workers parse under the key
+ * table, depth limit and UTF-8 checking of the thread that created the
+ * reader. Lines that fail to parse are skipped and counted, see
+ * json_lines_failed().
+ */
+enum {
+    LINES_FREE,
+    LINES_BUSY,
+    LINES_DONE
+};
+
+typedef struct
+{
+    int state;
+    long seq;
+    long count;
+    long next;
+    long max;
+    long failed;
+    box_t *records;
+} lines_slot_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t *threads;
+    int workers;
+    int order;
+    int stop;
+    box_t stream;
+    box_t keys;
+    long depth;
+    int utf8;
+    char *pointer;
+    char *end;
+    long claimed;
+    long given;
+    long failed;
+    long nslots;
+    lines_slot_t *current;
+    lines_slot_t *slots;
+} lines_t;
+
+static int lines_add(lines_slot_t *__slot, box_t __record)
+{
+    box_t *tmp;
+    
+    if (__slot->count == __slot->max)
+    {
+        if (!(tmp = realloc(__slot->records, (__slot->max * 2 + 0x40) * sizeof(box_t))))
+            return -1;
+        
+        __slot->records = tmp;
+        __slot->max = __slot->max * 2 + 0x40;
+    }
+    
+    __slot->records[__slot->count++] = __record;
+    
+    return 0;
+}
+
+static void lines_parse(lines_slot_t *__slot, char *__src, char *__end)
+{
+    char *p, *e;
+    box_t obj;
+    
+    for (p = __src; p < __end; p = e + 1)
+    {
+        if (!(e = memchr(p, '\n', __end - p)))
+            e = __end;
+        
+        *e = 0;
+        if (e > p && e[-1] == '\r') e[-1] = 0;
+        
+        while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+        
+        if (!*p) continue;
+        
+        if (!(obj = object_from_json_string(p)))
+        {
+            __slot->failed++;
+            continue;
+        }
+        
+        if (lines_add(__slot, obj))
+        {
+            ERROR(BOX_MEMORY_ERROR, "lines_parse()")
+            free_box(obj);
+            return;
+        }
+    }
+}
+
+static void* lines_worker(void *__arg)
+{
+    lines_t *l = __arg;
+    lines_slot_t *slot = NULL;
+    char *src, *end;
+    long i;
+    
+    keys_use(l->keys);
+    depth_use(l->depth);
+    utf8_use(l->utf8);
+    pthread_mutex_lock(&l->lock);
+    
+    for (;;)
+    {
+        while (!l->stop && l->pointer < l->end)
+        {
+            for (i = 0; i < l->nslots && l->slots[i].state != LINES_FREE; i++);
+            
+            if (i < l->nslots) break;
+            
+            pthread_cond_wait(&l->cond, &l->lock);
+        }
+        
+        if (l->stop || l->pointer >= l->end)
+            break;
+        
+        slot = l->slots + i;
+        slot->state = LINES_BUSY;
+        slot->seq = l->claimed++;
+        
+        src = l->pointer;
+        end = l->end - src > LINES_CHUNK ? src + LINES_CHUNK : l->end;
+        
+        if (end < l->end && !(end = memchr(end, '\n', l->end - end)))
+            end = l->end;
+        
+        l->pointer = end < l->end ? end + 1 : end;
+        
+        pthread_mutex_unlock(&l->lock);
+        
+        lines_parse(slot, src, end);
+        
+        pthread_mutex_lock(&l->lock);
+        
+        slot->state = LINES_DONE;
+        l->failed += slot->failed;
+        slot->failed = 0;
+        pthread_cond_broadcast(&l->cond);
+    }
+    
+    pthread_mutex_unlock(&l->lock);
+    
+    return NULL;
+}
+
+static void lines_stop(lines_t *__l)
+{
+    int i;
+    
+    pthread_mutex_lock(&__l->lock);
+    __l->stop = 1;
+    pthread_cond_broadcast(&__l->cond);
+    pthread_mutex_unlock(&__l->lock);
+    
+    for (i = 0; i < __l->workers; i++)
+        pthread_join(__l->threads[i], NULL);
+}
+
+/*
+ * Takes ownership of the stream. A thread count of zero or less uses
+ * one worker per online processor.
+ */
+box_t new_json_lines(box_t __stream, int __threads, int __order)
+{
+    long *box;
+    lines_t *l;
+    int i;
+    
+    if (!__stream) return 0;
+    
+    if (stream_writable(__stream))
+    {
+        ERROR(BOX_CREATE_ERROR, "new_json_lines()")
+        free_box(__stream);
+        return 0;
+    }
+    
+    if (__threads <= 0) __threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (__threads <= 0) __threads = 1;
+    if (__threads > LINES_THREADS_MAX) __threads = LINES_THREADS_MAX;
+    
+    if (!(box = malloc(BOX_HEADER)) || !(l = calloc(1, sizeof(lines_t))))
+    {
+        ERROR(BOX_MEMORY_ERROR, "new_json_lines()")
+        free(box);
+        free_box(__stream);
+        return 0;
+    }
+    
+    l->nslots = __threads * 2;
+    l->slots = calloc(l->nslots, sizeof(lines_slot_t));
+    l->threads = malloc(__threads * sizeof(pthread_t));
+    
+    if (!l->slots || !l->threads)
+    {
+        ERROR(BOX_MEMORY_ERROR, "new_json_lines()")
+        free(l->slots);
+        free(l->threads);
+        free(l);
+        free(box);
+        free_box(__stream);
+        return 0;
+    }
+    
+    pthread_mutex_init(&l->lock, NULL);
+    pthread_cond_init(&l->cond, NULL);
+    
+    l->order = __order;
+    l->stream = __stream;
+    l->keys = keys_current();
+    l->depth = depth_current();
+    l->utf8 = utf8_current();
+    l->pointer = box_buffer(__stream);
+    l->end = l->pointer + (box_size(__stream) > 0 ? box_size(__stream) - 1 : 0);
+    
+    box[0] = (long) l;
+    box[1] = 0;
+    box[2] = MINIBOX_TYPE_LINES;
+    box[3] = 0;
+    box[4] = 0;
+    box[5] = 0;
+    box[6] = 0;
+    
+    for (i = 0; i < __threads; i++)
+    {
+        if (pthread_create(l->threads + i, NULL, lines_worker, l))
+            break;
+        
+        l->workers++;
+    }
+    
+    if (!l->workers)
+    {
+        ERROR(BOX_CREATE_ERROR, "new_json_lines()")
+        free_box((box_t) box);
+        return 0;
+    }
+    
+    return (box_t) box;
+}
+
+box_t json_lines_from_file(const char *__path, int __threads, int __order)
+{
+    return new_json_lines(stream_load(__path), __threads, __order);
+}
+
+/*
+ * Returns the next record, owned by the caller, or 0 once the input is
+ * exhausted.
+ */
+box_t json_lines_next(box_t __box)
+{
+    lines_t *l = BOXB;
+    lines_slot_t *slot = l->current;
+    long i, busy;
+    
+    if (slot && slot->next < slot->count)
+        return slot->records[slot->next++];
+    
+    pthread_mutex_lock(&l->lock);
+    
+    if (slot)
+    {
+        slot->state = LINES_FREE;
+        slot->count = slot->next = 0;
+        l->current = NULL;
+        l->given++;
+        pthread_cond_broadcast(&l->cond);
+    }
+    
+    for (;;)
+    {
+        for (i = 0, busy = 0; i < l->nslots; i++)
+        {
+            slot = l->slots + i;
+            
+            if (slot->state == LINES_DONE && (l->order == MINIBOX_ORDER_ANY || slot->seq == l->given))
+                break;
+            
+            busy |= slot->state != LINES_FREE;
+        }
+        
+        if (i < l->nslots)
+        {
+            l->current = slot;
+            
+            if (slot->count) break;
+            
+            slot->state = LINES_FREE;
+            l->current = NULL;
+            l->given++;
+            pthread_cond_broadcast(&l->cond);
+            continue;
+        }
+        
+        if (!busy && l->pointer >= l->end)
+        {
+            pthread_mutex_unlock(&l->lock);
+            return 0;
+        }
+        
+        pthread_cond_wait(&l->cond, &l->lock);
+    }
+    
+    pthread_mutex_unlock(&l->lock);
+    
+    return slot->records[slot->next++];
+}
+
+/*
+ * Number of lines skipped so far because they did not parse.
+ */
+long json_lines_failed(box_t __box)
+{
+    lines_t *l = BOXB;
+    long failed;
+    
+    pthread_mutex_lock(&l->lock);
+    failed = l->failed;
+    pthread_mutex_unlock(&l->lock);
+    
+    return failed;
+}
+
+void lines_release(box_t __box)
+{
+    lines_t *l = BOXB;
+    long i, j;
+    
+    lines_stop(l);
+    
+    for (i = 0; i < l->nslots; i++)
+    {
+        for (j = l->slots[i].next; j < l->slots[i].count; j++)
+            free_box(l->slots[i].records[j]);
+        
+        free(l->slots[i].records);
+    }
+    
+    pthread_cond_destroy(&l->cond);
+    pthread_mutex_destroy(&l->lock);
+    
+    free_box(l->stream);
+    free(l->slots);
+    free(l->threads);
+    free(l);
+    free((void *) __box);
+}
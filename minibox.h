@@ -22,6 +22,8 @@
 #ifndef minibox_h
 #define minibox_h
 
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -37,13 +39,72 @@ enum
     MINIBOX_TYPE_STRING  = 0x8,
     MINIBOX_TYPE_STREAM  = 0xA,
     MINIBOX_TYPE_ARRAY   = 0xC,
-    MINIBOX_TYPE_OBJECT  = 0xE
+    MINIBOX_TYPE_OBJECT  = 0xE,
+    MINIBOX_TYPE_ARENA   = 0x10,
+    MINIBOX_TYPE_READER  = 0x12,
+    MINIBOX_TYPE_KEYS    = 0x14,
+    MINIBOX_TYPE_INTEGER = 0x16,
+    MINIBOX_TYPE_LINES   = 0x18,
+    MINIBOX_TYPE_PARSER  = 0x1A
+};
+
+enum
+{
+    MINIBOX_FORMAT_PRETTY  = 0x0,
+    MINIBOX_FORMAT_COMPACT = 0x1
+};
+
+enum
+{
+    MINIBOX_ORDER_KEEP = 0x0,
+    MINIBOX_ORDER_ANY  = 0x1
 };
 
 typedef long box_t;
 
+typedef struct
+{
+    int (*start_object)(void *__ctx);
+    int (*end_object)(void *__ctx);
+    int (*start_array)(void *__ctx);
+    int (*end_array)(void *__ctx);
+    int (*key)(void *__ctx, const char *__str, long __len);
+    int (*string)(void *__ctx, const char *__str, long __len);
+    int (*number)(void *__ctx, double __value);
+    int (*boolean)(void *__ctx, long __value);
+    int (*null)(void *__ctx);
+    int (*integer)(void *__ctx, long __value);
+} json_events_t;
+
+typedef struct
+{
+    int (*start_element)(void *__ctx, const char *__name, long __len);
+    int (*attribute)(void *__ctx, const char *__name, long __nlen, const char *__value, long __vlen);
+    int (*text)(void *__ctx, const char *__str, long __len);
+    int (*end_element)(void *__ctx, const char *__name, long __len);
+} xml_events_t;
+
 void free_box(box_t __box);
 
+long box_value_type(const void *__value);
+long box_value_boolean(const void *__value);
+double box_value_number(const void *__value);
+long box_value_integer(const void *__value);
+char* box_value_string(const void *__value);
+box_t box_value_box(const void *__value);
+
+//***************************************************************
+
+box_t new_arena(void);
+box_t arena_use(box_t __arena);
+
+box_t new_keys(void);
+box_t keys_use(box_t __keys);
+
+long depth_use(long __depth);
+
+int utf8_use(int __check);
+
 //***************************************************************
     
 box_t new_array(void);
@@ -55,26 +116,40 @@ long array_count(box_t __box);
 void array_add_null(box_t __box);
 void array_add_boolean(box_t __box, long __value);
 void array_add_number(box_t __box, double __value);
+void array_add_integer(box_t __box, long __value);
 void array_add_string(box_t __box, int __vmt, const char *__value);
 void array_add_box(box_t __box, int __vmt, box_t __value);
 
 void array_insert_null(box_t __box, long __index);
 void array_insert_boolean(box_t __box, long __index, long __value);
 void array_insert_number(box_t __box, long __index, double __value);
+void array_insert_integer(box_t __box, long __index, long __value);
 void array_insert_string(box_t __box, long __index, int __vmt, const char *__value);
 void array_insert_box(box_t __box, long __index, int __vmt, box_t __value);
     
 void array_set_boolean(box_t __box, long __index, long __value);
 void array_set_null(box_t __box, long __index);
-void array_set_number(box_t __box, long __index, long __value);
+void array_set_number(box_t __box, long __index, double __value);
+void array_set_integer(box_t __box, long __index, long __value);
 void array_set_string(box_t __box, long __index, int __vmt, const char *__value);
 void array_set_box(box_t __box, long __index, int __vmt, long __value);
 
-#define array_get_null(x, i) (*((long *) array_get(x, i)))
-#define array_get_boolean(x, i) (*((long *) array_get(x, i)))
-#define array_get_number(x, i) (*((double *) array_get(x, i)))
-#define array_get_string(x, i) (*((char **) array_get(x, i)))
-#define array_get_box(x, i) (*((box_t *) array_get(x, i)))
+int array_packed(box_t __box);
+const double* array_numbers(box_t __box);
+long array_copy_numbers(box_t __box, long __index, long __count, double *__dst);
+long array_copy_int64(box_t __box, long __index, long __count, long *__dst);
+double array_sum(box_t __box);
+double array_min(box_t __box);
+double array_max(box_t __box);
+double array_mean(box_t __box);
+double array_dot(box_t __box, box_t __other);
+
+#define array_get_null(x, i) box_value_boolean(array_get(x, i))
+#define array_get_boolean(x, i) box_value_boolean(array_get(x, i))
+#define array_get_number(x, i) box_value_number(array_get(x, i))
+#define array_get_integer(x, i) box_value_integer(array_get(x, i))
+#define array_get_string(x, i) box_value_string(array_get(x, i))
+#define array_get_box(x, i) box_value_box(array_get(x, i))
 
 //***************************************************************
     
@@ -87,33 +162,42 @@ long object_attributes(box_t __box);
 void object_put_null   (box_t __b,   int __kmt, const char *__key                                );
 void object_put_boolean(box_t __b,   int __kmt, const char *__key,            long        __value);
 void object_put_number (box_t __box, int __kmt, const char *__key,            double      __value);
+void object_put_integer(box_t __box, int __kmt, const char *__key,            long        __value);
 void object_put_string (box_t __box, int __kmt, const char *__key, int __vmt, const char *__value);
 void object_put_box    (box_t __box, int __kmt, const char *__key, int __vmt, box_t       __value);
 
 void object_set_null   (box_t __b, const char *__k                            );
 void object_set_boolean(box_t __b, const char *__k,            long        __v);
 void object_set_number (box_t __b, const char *__k,            double      __v);
+void object_set_integer(box_t __b, const char *__k,            long        __v);
 void object_set_string (box_t __b, const char *__k, int __vmt, const char *__v);
 void object_set_box    (box_t __b, const char *__k, int __vmt, box_t       __v);
 
-#define object_get_null(x, k) (*((long *) object_get(x, k)))
-#define object_get_boolean(x, k) (*((long *) object_get(x, k)))
-#define object_get_number(x, k) (*((double *) object_get(x, k)))
-#define object_get_string(x, k) (*((char **) object_get(x, k)))
-#define object_get_box(x, k) (*((box_t *) object_get(x, k)))
+#define object_get_null(x, k) box_value_boolean(object_get(x, k))
+#define object_get_boolean(x, k) box_value_boolean(object_get(x, k))
+#define object_get_number(x, k) box_value_number(object_get(x, k))
+#define object_get_integer(x, k) box_value_integer(object_get(x, k))
+#define object_get_string(x, k) box_value_string(object_get(x, k))
+#define object_get_box(x, k) box_value_box(object_get(x, k))
 
 //***************************************************************
 
 box_t new_stream(void);
+box_t new_stream_file(FILE *__file);
+int stream_flush(box_t __box);
 box_t stream_load(const char *__path);
 int stream_save(box_t __box, const char *__path);
 void stream_add(box_t __box, const char *__value);
+void stream_add_length(box_t __box, const char *__value, long __len);
 void stream_add_char(box_t __box, char __value);
 void stream_add_number(box_t __box, double __value);
+void stream_add_integer(box_t __box, long __value);
 void stream_paragraph(box_t __box, int __level);
 void stream_open_hierarchy(box_t __box, char __symbol, int __level);
 void stream_close_hierarchy(box_t __box, char __symbol, int __level);
 void stream_add_between(box_t __box, const char *__str, char __char);
+void stream_add_json_string(box_t __box, const char *__str, long __len);
+void stream_add_xml_text(box_t __box, const char *__str, long __len);
 void stream_finalize(box_t __box);
 char* stream_get(box_t __box);
 void stream_print(box_t __box);
@@ -122,13 +206,42 @@ void stream_print(box_t __box);
 
 box_t object_from_json_string(const char *__string);
 box_t object_from_json_file(const char *__path);
+box_t object_from_json_stream(box_t __stream);
+box_t object_from_json_lazy(box_t __stream);
+box_t object_from_json_string_paths(const char *__string, const char **__paths);
+box_t object_from_json_file_paths(const char *__path, const char **__paths);
+box_t object_from_json_string_parallel(const char *__string, int __threads);
+box_t object_from_json_file_parallel(const char *__path, int __threads);
+box_t new_json_parser(void);
+long json_parser_feed(box_t __parser, const char *__chunk, long __len);
+box_t json_parser_take(box_t __parser);
 box_t json_stream_from_object(box_t __box);
+box_t json_stream_from_object_format(box_t __box, int __format);
+void json_write_object(box_t __box, box_t __stream, int __format);
 int json_file_from_object(box_t __box, const char *__path);
+int json_file_from_object_format(box_t __box, const char *__path, int __format);
+int json_parse_events(const char *__string, const json_events_t *__events, void *__ctx);
+int json_parse_file_events(const char *__path, const json_events_t *__events, void *__ctx);
+
+box_t new_json_lines(box_t __stream, int __threads, int __order);
+box_t json_lines_from_file(const char *__path, int __threads, int __order);
+box_t json_lines_next(box_t __lines);
+long json_lines_failed(box_t __lines);
 
 box_t xml_object_from_string(const char *__string);
 box_t xml_object_from_file(const char *__path);
+box_t xml_object_from_string_paths(const char *__string, const char **__paths);
 box_t xml_stream_from_object(box_t __box);
+box_t xml_stream_from_object_format(box_t __box, int __format);
+void xml_write_object(box_t __box, box_t __stream, int __format);
 int xml_file_from_object(box_t __box, const char *__path);
+int xml_file_from_object_format(box_t __box, const char *__path, int __format);
+
+box_t new_xml_reader(const xml_events_t *__events, void *__ctx);
+int xml_reader_feed(box_t __reader, const char *__chunk, long __len);
+int xml_reader_finish(box_t __reader);
+int xml_parse_events(const char *__string, const xml_events_t *__events, void *__ctx);
+int xml_parse_file_events(const char *__path, const xml_events_t *__events, void *__ctx);
     
 #ifdef __cplusplus
 }
@@ -26,26 +26,178 @@ box_t new_object(void) {
     return box_create(MINIBOX_TYPE_OBJECT);
 }
 
-long object_index(box_t __box, const char *__key)
+#pragma mark - Index
+
+/*
+ * Objects with OBJECT_INDEX_MIN attributes or more keep an open
+ * addressing table (BOXH) that maps key hashes to slots. It is built on
+ * the first lookup that crosses the threshold and maintained by put and
+ * remove afterwards.
+ */
+#define OBJECT_INDEX_MIN 0x10
+#define BUCKET(x, i) (((bucket_t *) (((long *) (x)) + 1)) + (i))
+
+typedef struct
+{
+    unsigned hash;
+    unsigned slot;
+} bucket_t;
+
+static unsigned object_hash(const char *__key)
+{
+    unsigned h = 2166136261u;
+    
+    if (KEY_INTERNED(__key))
+        return KEY_HASH(__key);
+    
+    while (*__key)
+        h = (h ^ (unsigned char) *__key++) * 16777619u;
+    
+    return h;
+}
+
+unsigned object_hash_len(const char *__str, long __len)
+{
+    unsigned h = 2166136261u;
+    
+    while (__len--)
+        h = (h ^ (unsigned char) *__str++) * 16777619u;
+    
+    return h;
+}
+
+/*
+ * Interned keys of the same table are equal only if they are the same
+ * pointer; the hash check keeps keys of different tables comparable.
+ */
+static int object_key_equal(const char *__a, const char *__b)
+{
+    if (__a == __b)
+        return 1;
+    
+    if (KEY_INTERNED(__a) && KEY_INTERNED(__b) && KEY_HASH(__a) != KEY_HASH(__b))
+        return 0;
+    
+    return !strcmp(KEY_STR(__a), KEY_STR(__b));
+}
+
+static void object_index_insert(long *__index, unsigned __hash, long __slot)
+{
+    long i = __hash & __index[0];
+    
+    while (BUCKET(__index, i)->slot)
+        i = (i + 1) & __index[0];
+    
+    BUCKET(__index, i)->hash = __hash;
+    BUCKET(__index, i)->slot = (unsigned) __slot + 1;
+}
+
+static int object_index_build(box_t __box, long __count)
+{
+    long i, *index, mask = OBJECT_INDEX_MIN * 2 - 1;
+    
+    while (mask < __count * 2) mask = mask * 2 + 1;
+    
+    if (!(index = arena_alloc(BOXA, sizeof(long) + (mask + 1) * sizeof(bucket_t))))
+        return -1;
+    
+    index[0] = mask;
+    memset(BUCKET(index, 0), 0, (mask + 1) * sizeof(bucket_t));
+    
+    for (i = 0; i < __count; i++)
+        object_index_insert(index, object_hash(*(char **)(BOXB + i * V2S + MINIBOX_KEY)), i);
+    
+    arena_free(BOXA, (void *) BOXH);
+    ((long *) __box)[5] = (long) index;
+    
+    return 0;
+}
+
+static long object_find(box_t __box, const char *__key, unsigned __hash)
 {
-    long i;
+    long i, *index;
+    bucket_t *b;
+    long count = BOXS / V2S;
+    
+    if (count >= OBJECT_INDEX_MIN && (BOXH || !object_index_build(__box, count)))
+    {
+        index = (long *) BOXH;
+        
+        for (i = __hash & index[0]; (b = BUCKET(index, i))->slot; i = (i + 1) & index[0])
+            if (b->hash == __hash &&
+                object_key_equal(*((char **)(BOXB + (b->slot - 1) * V2S + MINIBOX_KEY)), __key))
+                return b->slot - 1;
+        
+        return -1;
+    }
     
-    for (i = 0; i < BOXS; i += V3S) {
-        if (!strcmp(*((char **)(BOXB + i + MINIBOX_KEY)), __key))
-            return i / V3S;
+    for (i = 0; i < BOXS; i += V2S) {
+        if (object_key_equal(*((char **)(BOXB + i + MINIBOX_KEY)), __key))
+            return i / V2S;
     }
     
     return -1;
 }
 
+static long object_bucket(long *__index, unsigned __hash, long __slot)
+{
+    long i = __hash & __index[0];
+    
+    while (BUCKET(__index, i)->slot != __slot + 1)
+        i = (i + 1) & __index[0];
+    
+    return i;
+}
+
+/*
+ * Drops the bucket of __slot, found through its hash, by backward shift
+ * deletion, and renumbers the buckets of the slots after it, which the
+ * caller moves down one place. The work is bounded by that move rather
+ * than by the size of the table.
+ */
+static void object_index_remove(box_t __box, long __slot, unsigned __hash)
+{
+    long i, j, k, count = BOXS / V2S, *index = (long *) BOXH;
+    bucket_t *b;
+    
+    i = object_bucket(index, __hash, __slot);
+    
+    for (j = (i + 1) & index[0]; (b = BUCKET(index, j))->slot; j = (j + 1) & index[0])
+    {
+        k = b->hash & index[0];
+        
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+        {
+            *BUCKET(index, i) = *b;
+            i = j;
+        }
+    }
+    
+    BUCKET(index, i)->slot = 0;
+    
+    for (j = __slot + 1; j < count; j++)
+    {
+        b = BUCKET(index, object_bucket(index, object_hash(*(char **)(BOXB + j * V2S + MINIBOX_KEY)), j));
+        b->slot--;
+    }
+}
+
+long object_index(box_t __box, const char *__key)
+{
+    BOX_LOAD(__box);
+    
+    return object_find(__box, __key, object_hash(__key));
+}
+
+#pragma mark - Access
+
 void object_set_at(box_t __box, long __index, const void *__value, long __type)
 {
-    long p = __index * V3S;
+    long p = __index * V2S;
     
-    box_free_value(BOXB + p);
+    box_free_value(__box, BOXB + p);
     
-    box_set(__box, p + MINIBOX_VALUE, __value);
-    box_set(__box, p + MINIBOX_TYPE, &__value);
+    SLOT(BOXB + p + MINIBOX_VALUE) = box_value(__box, __type, __value);
 }
 
 void object_set(box_t __box, const char *__key, const void *__value, long __type)
@@ -59,21 +211,44 @@ void object_set(box_t __box, const char *__key, const void *__value, long __type
 
 void object_put(box_t __box, const char *__key, int _kf, const void *__value, long __type)
 {
-    long index = object_index(__box, __key);
+    box_t keys = keys_current();
+    const char *key;
+    unsigned hash;
+    long index;
+    
+    BOX_LOAD(__box);
+    
+    if (keys && !KEY_INTERNED(__key) && (key = keys_intern(keys, __key, strlen(__key))))
+    {
+        if (_kf) arena_free(BOXA, (void *) __key);
+        __key = key;
+    }
+    
+    hash = object_hash(__key);
+    index = object_find(__box, __key, hash);
     
     if (index < 0)
     {
-        if (box_reallocated(__box, V3S)) return;
+        if (box_reallocated(__box, V2S)) return;
+        
+        const long pos = BOXS - V2S;
+        key = _kf || KEY_INTERNED(__key) ? __key : box_copy_str(BOXA, __key);
         
-        const long pos = BOXS - V3S;
-        const char *key = _kf ? __key : box_copy_str(__key);
+        SLOT(BOXB + pos + MINIBOX_VALUE) = box_value(__box, __type, __value);
+        box_set(__box, pos + MINIBOX_KEY, &key);
         
-        box_set(__box, pos + MINIBOX_VALUE, __value);
-        box_set(__box, pos + MINIBOX_TYPE, &__type);
-        box_set(__box, pos + MINIBOX_KEY,  &key);
+        if (BOXH)
+        {
+            if ((pos / V2S + 1) * 2 > ((long *) BOXH)[0])
+                object_index_build(__box, pos / V2S + 1);
+            else
+                object_index_insert((long *) BOXH, hash, pos / V2S);
+        }
     }
     else
     {
+        if (_kf && !KEY_INTERNED(__key)) arena_free(BOXA, (void *) __key);
+        
         object_set_at(__box, index, __value, __type);
     }
 }
@@ -84,25 +259,38 @@ void* object_get(box_t __box, const char *__key)
     
     if (index < 0) return NULL;
     
-    return BOXB + (index * V3S);
+    return BOXB + (index * V2S);
 }
 
 void object_remove(box_t __box, const char *__key)
 {
-    long p = object_index(__box, __key) * V3S;
+    unsigned hash;
+    long index, p;
+    
+    BOX_LOAD(__box);
+    
+    hash = object_hash(__key);
+    index = object_find(__box, __key, hash);
+    p = index * V2S;
+    
+    if (index < 0) return;
     
-    if (p < 0) return;
+    box_free_value(__box, BOXB + p);
     
-    box_free_value(BOXB + p);
+    if (!KEY_INTERNED(*(char **)(BOXB + p + MINIBOX_KEY)))
+        arena_free(BOXA, *(char **)(BOXB + p + MINIBOX_KEY));
     
-    if (box_move(__box, p + V3S, p, (BOXS - V3S) - p))
+    if (BOXH) object_index_remove(__box, index, hash);
+    
+    if (box_move(__box, p + V2S, p, (BOXS - V2S) - p))
         return;
     
-    if (box_reallocated(__box, -V3S)) return;
+    if (box_reallocated(__box, -V2S)) return;
 }
 
 long object_attributes(box_t __box) {
-    return BOXS / V3S;
+    BOX_LOAD(__box);
+    return BOXS / V2S;
 }
 
 #pragma mark - Set
@@ -120,6 +308,10 @@ void object_set_number(box_t __b, const char *__k, double __v) {
     object_set(__b, __k, &__v, MINIBOX_TYPE_NUMBER);
 }
 
+void object_set_integer(box_t __b, const char *__k, long __v) {
+    object_set(__b, __k, &__v, MINIBOX_TYPE_INTEGER);
+}
+
 void object_set_string(box_t __b, const char *__k, int _vf, const char *__v) {
     object_set(__b, __k, &__v, MINIBOX_TYPE_STRING + _vf);
 }
@@ -143,6 +335,10 @@ void object_put_number(box_t __b, int _kf, const char *__k, double __v) {
     object_put(__b, __k, _kf, &__v, MINIBOX_TYPE_NUMBER);
 }
 
+void object_put_integer(box_t __b, int _kf, const char *__k, long __v) {
+    object_put(__b, __k, _kf, &__v, MINIBOX_TYPE_INTEGER);
+}
+
 void object_put_string(box_t __b, int _kf, const char *__k, int _vf, const char *__v) {
     object_put(__b, __k, _kf, &__v, MINIBOX_TYPE_STRING + _vf);
 }
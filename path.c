@@ -0,0 +1,231 @@
+//
+//  path.c
+//  minibox
+//
+//  Created by Antonio Angel Martínez Domínguez on 1/6/19.
+//
+//  Copyright 2019 Rokit Systems
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "box.h"
+
+#define PATH_SYNTAX_ERROR "Invalid path."
+
+/*
+ * Projection paths ("user.id", "items[*].price", "rows[0]") compiled
+ * into a tree that the parsers walk along with the document. A node
+ * matches a key (len >= 0, "*" for any key) or an array item (len < 0,
+ * index < 0 for any item); leaf nodes take their whole subtree. The
+ * wildcards are merged into their explicit siblings once compiled, so a
+ * field named by both follows the union of the two branches.
+ */
+
+static path_t* path_node(path_t *__parent, const char *__key, long __len, long __index)
+{
+    path_t *n;
+    
+    for (n = __parent->child; n; n = n->next)
+        if (n->len == __len && n->index == __index &&
+            (__len < 0 || !memcmp(n->key, __key, __len)))
+            return n;
+    
+    if (!(n = calloc(1, sizeof(path_t) + (__len > 0 ? __len : 0))))
+    {
+        ERROR(BOX_MEMORY_ERROR, "path_node()")
+        return NULL;
+    }
+    
+    if (__len > 0) memcpy(n->key, __key, __len);
+    
+    n->len = __len;
+    n->index = __index;
+    n->next = __parent->child;
+    __parent->child = n;
+    
+    return n;
+}
+
+static int path_add(path_t *__root, const char *__path, int __items)
+{
+    const char *p = __path, *k;
+    path_t *n = __root;
+    char *end;
+    long index;
+    
+    while (*p)
+    {
+        if (*p == '[')
+        {
+            if (p[1] == '*' && p[2] == ']')
+            {
+                index = -1;
+                p += 3;
+            }
+            else
+            {
+                index = strtol(p + 1, &end, 10);
+                EIF(end == p + 1 || *end != ']' || index < 0, PATH_SYNTAX_ERROR, __path)
+                p = end + 1;
+            }
+            
+            EIF(*p && *p != '.' && *p != '[', PATH_SYNTAX_ERROR, __path)
+            
+            if (__items && !(n = path_node(n, NULL, -1, index)))
+                return -1;
+        }
+        else
+        {
+            for (k = p; *p && *p != '.' && *p != '['; p++);
+            
+            EIF(p == k, PATH_SYNTAX_ERROR, __path)
+            
+            if (!(n = path_node(n, k, p - k, -1)))
+                return -1;
+        }
+        
+        if (*p == '.')
+            EIF(!*++p, PATH_SYNTAX_ERROR, __path)
+    }
+    
+    EIF(n == __root, PATH_SYNTAX_ERROR, __path)
+    
+    n->leaf = 1;
+    
+    return 0;
+}
+
+static int path_merge(path_t *__dst, const path_t *__src)
+{
+    const path_t *c;
+    path_t *n;
+    
+    if (__src->leaf) __dst->leaf = 1;
+    
+    for (c = __src->child; c; c = c->next)
+        if (!(n = path_node(__dst, c->key, c->len, c->index)) || path_merge(n, c))
+            return -1;
+    
+    return 0;
+}
+
+static int path_spread(path_t *__path)
+{
+    path_t *n, *any, *key = NULL, *item = NULL;
+    
+    for (n = __path->child; n; n = n->next)
+    {
+        if (n->len == 1 && n->key[0] == '*')
+            key = n;
+        else if (n->len < 0 && n->index < 0)
+            item = n;
+    }
+    
+    for (n = __path->child; n; n = n->next)
+    {
+        any = n->len < 0 ? item : key;
+        
+        if (any && n != any && path_merge(n, any))
+            return -1;
+        
+        if (path_spread(n))
+            return -1;
+    }
+    
+    return 0;
+}
+
+/*
+ * __paths is NULL terminated. Item selectors are dropped when __items is
+ * zero (XML, where lists are not nested in their own level).
+ */
+path_t* path_compile(const char **__paths, int __items)
+{
+    path_t *root;
+    
+    if (!(root = calloc(1, sizeof(path_t))))
+    {
+        ERROR(BOX_MEMORY_ERROR, "path_compile()")
+        return NULL;
+    }
+    
+    root->len = -1;
+    root->index = -1;
+    
+    while (__paths && *__paths)
+    {
+        if (path_add(root, *__paths++, __items))
+        {
+            path_free(root);
+            return NULL;
+        }
+    }
+    
+    if (path_spread(root))
+    {
+        path_free(root);
+        return NULL;
+    }
+    
+    return root;
+}
+
+void path_free(path_t *__path)
+{
+    path_t *n;
+    
+    while (__path)
+    {
+        path_free(__path->child);
+        n = __path->next;
+        free(__path);
+        __path = n;
+    }
+}
+
+const path_t* path_key(const path_t *__path, const char *__key, long __len)
+{
+    const path_t *n, *any = NULL;
+    
+    for (n = __path->child; n; n = n->next)
+    {
+        if (n->len == __len && !memcmp(n->key, __key, __len))
+            return n;
+        
+        if (n->len == 1 && n->key[0] == '*')
+            any = n;
+    }
+    
+    return any;
+}
+
+const path_t* path_item(const path_t *__path, long __index)
+{
+    const path_t *n, *any = NULL;
+    
+    for (n = __path->child; n; n = n->next)
+    {
+        if (n->len >= 0) continue;
+        
+        if (n->index == __index)
+            return n;
+        
+        if (n->index < 0)
+            any = n;
+    }
+    
+    return any;
+}
@@ -0,0 +1,558 @@
+//
+//  scan.c
+//  minibox
+//
+//  Created by Antonio Angel Martínez Domínguez on 1/6/19.
+//
+//  Copyright 2019 Rokit Systems
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include <string.h>
+#include <pthread.h>
+#include "box.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/*
+ * First pass of the JSON parser. The source is classified 64 bytes at a
+ * time into bit masks (quotes, backslashes, whitespace and operators),
+ * and the masks are reduced to the positions the parser has to stop at:
+ * operators outside strings, unescaped quotes and the first byte of
+ * every literal. Carries between blocks live in scan_t so the source can
+ * be indexed in windows as the parser advances. When the thread checks
+ * UTF-8 (utf8_use()) every window is validated right after it is
+ * indexed, while it is still in cache, and invalid is set on failure.
+ */
+
+typedef struct
+{
+    unsigned long quote;
+    unsigned long slash;
+    unsigned long space;
+    unsigned long op;
+} mask_t;
+
+static void scan_block_scalar(const unsigned char *__src, mask_t *__mask)
+{
+    unsigned long bit;
+    int i;
+
+    memset(__mask, 0, sizeof(mask_t));
+
+    for (i = 0; i < 64; i++)
+    {
+        bit = 1UL << i;
+
+        switch (__src[i])
+        {
+            case '"': __mask->quote |= bit; break;
+            case '\\': __mask->slash |= bit; break;
+            case ' ': case '\t': case '\n': case '\r':
+                __mask->space |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',':
+                __mask->op |= bit; break;
+            default: break;
+        }
+    }
+}
+
+#ifdef SCAN_X86
+
+#define EQ16(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define EQ32(v, c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+
+static void scan_block_sse2(const unsigned char *__src, mask_t *__mask)
+{
+    int i;
+
+    memset(__mask, 0, sizeof(mask_t));
+
+    for (i = 0; i < 64; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (__src + i));
+        __m128i s = _mm_or_si128(_mm_or_si128(EQ16(v, ' '), EQ16(v, '\t')),
+                                 _mm_or_si128(EQ16(v, '\n'), EQ16(v, '\r')));
+        __m128i o = _mm_or_si128(_mm_or_si128(EQ16(v, '{'), EQ16(v, '}')),
+                                 _mm_or_si128(EQ16(v, '['), EQ16(v, ']')));
+        o = _mm_or_si128(o, _mm_or_si128(EQ16(v, ':'), EQ16(v, ',')));
+
+        __mask->quote |= (unsigned long) (unsigned) _mm_movemask_epi8(EQ16(v, '"')) << i;
+        __mask->slash |= (unsigned long) (unsigned) _mm_movemask_epi8(EQ16(v, '\\')) << i;
+        __mask->space |= (unsigned long) (unsigned) _mm_movemask_epi8(s) << i;
+        __mask->op |= (unsigned long) (unsigned) _mm_movemask_epi8(o) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static void scan_block_avx2(const unsigned char *__src, mask_t *__mask)
+{
+    int i;
+
+    memset(__mask, 0, sizeof(mask_t));
+
+    for (i = 0; i < 64; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (__src + i));
+        __m256i s = _mm256_or_si256(_mm256_or_si256(EQ32(v, ' '), EQ32(v, '\t')),
+                                    _mm256_or_si256(EQ32(v, '\n'), EQ32(v, '\r')));
+        __m256i o = _mm256_or_si256(_mm256_or_si256(EQ32(v, '{'), EQ32(v, '}')),
+                                    _mm256_or_si256(EQ32(v, '['), EQ32(v, ']')));
+        o = _mm256_or_si256(o, _mm256_or_si256(EQ32(v, ':'), EQ32(v, ',')));
+
+        __mask->quote |= (unsigned long) (unsigned) _mm256_movemask_epi8(EQ32(v, '"')) << i;
+        __mask->slash |= (unsigned long) (unsigned) _mm256_movemask_epi8(EQ32(v, '\\')) << i;
+        __mask->space |= (unsigned long) (unsigned) _mm256_movemask_epi8(s) << i;
+        __mask->op |= (unsigned long) (unsigned) _mm256_movemask_epi8(o) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static long scan_string_avx2(const unsigned char *__src, long __len)
+{
+    long i;
+    unsigned m;
+
+    for (i = 0; i + 32 <= __len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (__src + i));
+
+        if ((m = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(EQ32(v, '"'), EQ32(v, '\\')))))
+            return i + __builtin_ctz(m);
+    }
+
+    for (; i < __len; i++)
+        if (__src[i] == '"' || __src[i] == '\\')
+            break;
+
+    return i;
+}
+
+/*
+ * Copy kernels store whole blocks free of backslashes and stop at the
+ * first one. __dst may be __src or lie before it: a block is only stored
+ * once loaded, and never past the source bytes still to be read.
+ */
+__attribute__((target("avx2")))
+static long scan_copy_avx2(char *__dst, const char *__src, long __len)
+{
+    long i, n;
+    unsigned m;
+
+    for (i = 0; i + 32 <= __len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (__src + i));
+
+        if ((m = (unsigned) _mm256_movemask_epi8(EQ32(v, '\\'))))
+        {
+            for (n = i + __builtin_ctz(m); i < n; i++)
+                __dst[i] = __src[i];
+
+            return i;
+        }
+
+        _mm256_storeu_si256((__m256i *) (__dst + i), v);
+    }
+
+    for (; i < __len && __src[i] != '\\'; i++)
+        __dst[i] = __src[i];
+
+    return i;
+}
+
+static long scan_copy_sse2(char *__dst, const char *__src, long __len)
+{
+    long i, n;
+    unsigned m;
+
+    for (i = 0; i + 16 <= __len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (__src + i));
+
+        if ((m = (unsigned) _mm_movemask_epi8(EQ16(v, '\\'))))
+        {
+            for (n = i + __builtin_ctz(m); i < n; i++)
+                __dst[i] = __src[i];
+
+            return i;
+        }
+
+        _mm_storeu_si128((__m128i *) (__dst + i), v);
+    }
+
+    for (; i < __len && __src[i] != '\\'; i++)
+        __dst[i] = __src[i];
+
+    return i;
+}
+
+/*
+ * Escape kernels stop at the first control byte or byte of __set, the
+ * three characters a serializer has to escape. Tails of at least one
+ * block are checked with a last block overlapping the one before, the
+ * bytes seen twice being known clean.
+ */
+#define ESCAPE16(v) _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, a), _mm_cmpeq_epi8(v, b)), \
+    _mm_or_si128(_mm_cmpeq_epi8(v, c), _mm_cmpeq_epi8(_mm_min_epu8(v, k), v)))
+#define ESCAPE32(v) _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, a), _mm256_cmpeq_epi8(v, b)), \
+    _mm256_or_si256(_mm256_cmpeq_epi8(v, c), _mm256_cmpeq_epi8(_mm256_min_epu8(v, k), v)))
+
+static long scan_escape_sse2(const unsigned char *__src, long __len, const char *__set)
+{
+    long i;
+    unsigned m;
+    __m128i v;
+    __m128i a = _mm_set1_epi8(__set[0]);
+    __m128i b = _mm_set1_epi8(__set[1]);
+    __m128i c = _mm_set1_epi8(__set[2]);
+    __m128i k = _mm_set1_epi8(0x1F);
+
+    if (__len < 16)
+    {
+        for (i = 0; i < __len; i++)
+            if (__src[i] < 0x20 || __src[i] == __set[0] || __src[i] == __set[1] || __src[i] == __set[2])
+                break;
+
+        return i;
+    }
+
+    for (i = 0; i + 16 <= __len; i += 16)
+    {
+        v = _mm_loadu_si128((const __m128i *) (__src + i));
+
+        if ((m = (unsigned) _mm_movemask_epi8(ESCAPE16(v))))
+            return i + __builtin_ctz(m);
+    }
+
+    if (i == __len) return i;
+
+    i = __len - 16;
+    v = _mm_loadu_si128((const __m128i *) (__src + i));
+
+    return (m = (unsigned) _mm_movemask_epi8(ESCAPE16(v))) ? i + __builtin_ctz(m) : __len;
+}
+
+__attribute__((target("avx2")))
+static long scan_escape_avx2(const unsigned char *__src, long __len, const char *__set)
+{
+    long i;
+    unsigned m;
+    __m256i v;
+    __m256i a = _mm256_set1_epi8(__set[0]);
+    __m256i b = _mm256_set1_epi8(__set[1]);
+    __m256i c = _mm256_set1_epi8(__set[2]);
+    __m256i k = _mm256_set1_epi8(0x1F);
+
+    if (__len < 32)
+        return scan_escape_sse2(__src, __len, __set);
+
+    for (i = 0; i + 32 <= __len; i += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *) (__src + i));
+
+        if ((m = (unsigned) _mm256_movemask_epi8(ESCAPE32(v))))
+            return i + __builtin_ctz(m);
+    }
+
+    if (i == __len) return i;
+
+    i = __len - 32;
+    v = _mm256_loadu_si256((const __m256i *) (__src + i));
+
+    return (m = (unsigned) _mm256_movemask_epi8(ESCAPE32(v))) ? i + __builtin_ctz(m) : __len;
+}
+
+/*
+ * Terminated variants read aligned blocks, which never cross a page, from
+ * the one holding __src until a control byte (the NUL included) or a byte
+ * of __set turns up; bytes before __src are masked out.
+ */
+__attribute__((no_sanitize_address))
+static long scan_escape_string_sse2(const unsigned char *__src, const char *__set)
+{
+    const unsigned char *p = (const unsigned char *) ((unsigned long) __src & ~15UL);
+    unsigned m;
+    __m128i v;
+    __m128i a = _mm_set1_epi8(__set[0]);
+    __m128i b = _mm_set1_epi8(__set[1]);
+    __m128i c = _mm_set1_epi8(__set[2]);
+    __m128i k = _mm_set1_epi8(0x1F);
+
+    v = _mm_load_si128((const __m128i *) p);
+
+    if ((m = (unsigned) _mm_movemask_epi8(ESCAPE16(v)) >> (__src - p)))
+        return __builtin_ctz(m);
+
+    for (;;)
+    {
+        p += 16;
+        v = _mm_load_si128((const __m128i *) p);
+
+        if ((m = (unsigned) _mm_movemask_epi8(ESCAPE16(v))))
+            return p - __src + __builtin_ctz(m);
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static long scan_escape_string_avx2(const unsigned char *__src, const char *__set)
+{
+    const unsigned char *p = (const unsigned char *) ((unsigned long) __src & ~31UL);
+    unsigned m;
+    __m256i v;
+    __m256i a = _mm256_set1_epi8(__set[0]);
+    __m256i b = _mm256_set1_epi8(__set[1]);
+    __m256i c = _mm256_set1_epi8(__set[2]);
+    __m256i k = _mm256_set1_epi8(0x1F);
+
+    v = _mm256_load_si256((const __m256i *) p);
+
+    if ((m = (unsigned) _mm256_movemask_epi8(ESCAPE32(v)) >> (__src - p)))
+        return __builtin_ctz(m);
+
+    for (;;)
+    {
+        p += 32;
+        v = _mm256_load_si256((const __m256i *) p);
+
+        if ((m = (unsigned) _mm256_movemask_epi8(ESCAPE32(v))))
+            return p - __src + __builtin_ctz(m);
+    }
+}
+
+static long scan_string_sse2(const unsigned char *__src, long __len)
+{
+    long i;
+    unsigned m;
+
+    for (i = 0; i + 16 <= __len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (__src + i));
+
+        if ((m = (unsigned) _mm_movemask_epi8(_mm_or_si128(EQ16(v, '"'), EQ16(v, '\\')))))
+            return i + __builtin_ctz(m);
+    }
+
+    for (; i < __len; i++)
+        if (__src[i] == '"' || __src[i] == '\\')
+            break;
+
+    return i;
+}
+
+#endif
+
+static long scan_copy_scalar(char *__dst, const char *__src, long __len)
+{
+    long i;
+
+    for (i = 0; i < __len && __src[i] != '\\'; i++)
+        __dst[i] = __src[i];
+
+    return i;
+}
+
+static long scan_escape_scalar(const unsigned char *__src, long __len, const char *__set)
+{
+    long i;
+
+    for (i = 0; i < __len; i++)
+        if (__src[i] < 0x20 || __src[i] == __set[0] || __src[i] == __set[1] || __src[i] == __set[2])
+            break;
+
+    return i;
+}
+
+static long scan_escape_string_scalar(const unsigned char *__src, const char *__set)
+{
+    long i;
+
+    for (i = 0; __src[i] >= 0x20 && __src[i] != __set[0] && __src[i] != __set[1] && __src[i] != __set[2]; i++);
+
+    return i;
+}
+
+static long scan_string_scalar(const unsigned char *__src, long __len)
+{
+    long i;
+
+    for (i = 0; i < __len; i++)
+        if (__src[i] == '"' || __src[i] == '\\')
+            break;
+
+    return i;
+}
+
+static void (*scan_block)(const unsigned char *, mask_t *) = NULL;
+static long (*scan_quote)(const unsigned char *, long) = NULL;
+static long (*scan_run)(char *, const char *, long) = NULL;
+static long (*scan_special)(const unsigned char *, long, const char *) = NULL;
+static long (*scan_special_string)(const unsigned char *, const char *) = NULL;
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_select(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_block = scan_block_avx2;
+        scan_quote = scan_string_avx2;
+        scan_run = scan_copy_avx2;
+        scan_special = scan_escape_avx2;
+        scan_special_string = scan_escape_string_avx2;
+        return;
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        scan_block = scan_block_sse2;
+        scan_quote = scan_string_sse2;
+        scan_run = scan_copy_sse2;
+        scan_special = scan_escape_sse2;
+        scan_special_string = scan_escape_string_sse2;
+        return;
+    }
+#endif
+    scan_block = scan_block_scalar;
+    scan_quote = scan_string_scalar;
+    scan_run = scan_copy_scalar;
+    scan_special = scan_escape_scalar;
+    scan_special_string = scan_escape_string_scalar;
+}
+
+static unsigned long scan_prefix_xor(unsigned long __x)
+{
+    __x ^= __x << 1;
+    __x ^= __x << 2;
+    __x ^= __x << 4;
+    __x ^= __x << 8;
+    __x ^= __x << 16;
+    __x ^= __x << 32;
+    return __x;
+}
+
+static unsigned long scan_escaped(scan_t *__scan, unsigned long __slash)
+{
+    const unsigned long even = 0x5555555555555555UL;
+    unsigned long follows, odd, seq, invert;
+
+    __slash &= ~__scan->escaped;
+    follows = __slash << 1 | __scan->escaped;
+    odd = __slash & ~even & ~follows;
+    seq = odd + __slash;
+    __scan->escaped = seq < odd;
+    invert = seq << 1;
+
+    return (even ^ invert) & follows;
+}
+
+void scan_init(scan_t *__scan, const char *__src, long __len)
+{
+    memset(__scan, 0, sizeof(scan_t));
+    __scan->src = __src;
+    __scan->len = __len;
+    __scan->utf8 = utf8_current();
+
+    pthread_once(&scan_once, scan_select);
+}
+
+long scan_json(scan_t *__scan, long *__index, long __max)
+{
+    unsigned char tail[64];
+    const unsigned char *src;
+    unsigned long quote, string, scalar, bits;
+    long count = 0;
+    mask_t mask;
+
+    while (__scan->pos < __scan->len && __max - count >= 64)
+    {
+        src = (const unsigned char *) __scan->src + __scan->pos;
+
+        if (__scan->len - __scan->pos < 64)
+        {
+            memset(tail, ' ', 64);
+            memcpy(tail, src, __scan->len - __scan->pos);
+            src = tail;
+        }
+
+        scan_block(src, &mask);
+
+        quote = mask.quote & ~scan_escaped(__scan, mask.slash);
+        string = scan_prefix_xor(quote) ^ __scan->string;
+        __scan->string = (unsigned long) ((long) string >> 63);
+
+        scalar = ~(mask.op | mask.space | quote) & ~string;
+        bits = (mask.op & ~string) | quote |
+               (scalar & ~(scalar << 1 | __scan->scalar));
+        __scan->scalar = scalar >> 63;
+
+        while (bits)
+        {
+            __index[count++] = __scan->pos + __builtin_ctzl(bits);
+            bits &= bits - 1;
+        }
+
+        __scan->pos += 64;
+    }
+
+    if (__scan->utf8 && !__scan->invalid && __scan->valid < __scan->len)
+        __scan->invalid = utf8_range(__scan->src, &__scan->valid,
+                                     __scan->pos < __scan->len ? __scan->pos : __scan->len,
+                                     __scan->pos >= __scan->len);
+
+    return count;
+}
+
+/*
+ * Returns the offset of the first quote or backslash of __src, or __len
+ * if there is none, for readers that walk strings without the masks.
+ */
+long scan_string(const char *__src, long __len)
+{
+    pthread_once(&scan_once, scan_select);
+
+    return scan_quote((const unsigned char *) __src, __len);
+}
+
+/*
+ * Copies __src to __dst up to the first backslash and returns how many
+ * bytes were copied; __dst may overlap __src from below.
+ */
+long scan_copy(char *__dst, const char *__src, long __len)
+{
+    pthread_once(&scan_once, scan_select);
+
+    return scan_run(__dst, __src, __len);
+}
+
+/*
+ * Returns the offset of the first byte of __src below 0x20 or among the
+ * three characters of __set, or __len if there is none, so serializers
+ * can copy clean runs whole and escape only what they must. A negative
+ * __len scans a NUL terminated __src, stopping at the NUL at the latest,
+ * so its length needs no pass of its own.
+ */
+long scan_escape(const char *__src, long __len, const char *__set)
+{
+    pthread_once(&scan_once, scan_select);
+
+    if (__len < 0)
+        return scan_special_string((const unsigned char *) __src, __set);
+
+    return scan_special((const unsigned char *) __src, __len, __set);
+}
@@ -19,27 +19,87 @@
 //  limitations under the License.
 //
 
+#define _GNU_SOURCE
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "box.h"
 
+#define STREAM_CHUNK 0x10000
+#define STREAM_JSON_SET "\"\\\""
+#define STREAM_XML_SET "<&>"
+
 box_t new_stream(void)
 {
     return box_create(MINIBOX_TYPE_STREAM);
 }
 
-void stream_add(box_t __box, const char *__value)
+/*
+ * A file stream keeps at most STREAM_CHUNK bytes (more only for a single
+ * larger write) and hands them to its FILE, kept in BOXH, whenever the
+ * next write would not fit.
+ */
+box_t new_stream_file(FILE *__file)
 {
-    long len = strlen(__value);
-    if (box_reallocated(__box, len)) return;
+    box_t __box;
+    
+    if (!(__box = new_stream()))
+        return 0;
+    
+    if (box_reallocated(__box, STREAM_CHUNK))
+    {
+        free_box(__box);
+        return 0;
+    }
     
-    void *dst = BOXB + BOXS - len;
+    ((long *) __box)[1] = 0;
+    ((long *) __box)[5] = (long) __file;
     
-    memcpy(dst, __value, len);
+    return __box;
+}
+
+int stream_flush(box_t __box)
+{
+    FILE *file = (FILE *) BOXH;
+    long len = BOXS;
+    
+    if (!file) return 0;
+    
+    ((long *) __box)[1] = 0;
+    
+    if (len && fwrite(BOXB, 1, len, file) != (size_t) len)
+        return -1;
+    
+    return ferror(file) ? -1 : 0;
+}
+
+static int stream_reserve(box_t __box, long __size)
+{
+    if (BOXH && BOXS && BOXS + __size > BOXM)
+        stream_flush(__box);
+    
+    return box_reallocated(__box, __size);
+}
+
+void stream_add_length(box_t __box, const char *__value, long __len)
+{
+    if (stream_reserve(__box, __len)) return;
+    
+    void *dst = BOXB + BOXS - __len;
+    
+    memcpy(dst, __value, __len);
+}
+
+void stream_add(box_t __box, const char *__value)
+{
+    stream_add_length(__box, __value, strlen(__value));
 }
 
 void stream_add_char(box_t __box, char __value)
 {
-    if (box_reallocated(__box, 1)) return;
+    if (stream_reserve(__box, 1)) return;
     
     void *dst = BOXB + BOXS - 1;
     
@@ -53,14 +113,31 @@ char* stream_get(box_t __box)
 
 void stream_add_number(box_t __box, double __value)
 {
-    stream_add(__box, box_number_string(__value));
+    long len;
+    
+    if (stream_reserve(__box, NUMBER_STRING_MAX)) return;
+    
+    len = number_format(__value, BOXB + BOXS - NUMBER_STRING_MAX);
+    
+    box_reallocated(__box, len - NUMBER_STRING_MAX);
+}
+
+void stream_add_integer(box_t __box, long __value)
+{
+    long len;
+    
+    if (stream_reserve(__box, NUMBER_STRING_MAX)) return;
+    
+    len = number_format_integer(__value, BOXB + BOXS - NUMBER_STRING_MAX);
+    
+    box_reallocated(__box, len - NUMBER_STRING_MAX);
 }
 
 void stream_open_hierarchy(box_t __box, char __char, int __level)
 {
     long size = 2 + __level;
     
-    if (box_reallocated(__box, size)) return;
+    if (stream_reserve(__box, size)) return;
     
     void *dst = BOXB + BOXS - size;
     
@@ -73,7 +150,7 @@ void stream_paragraph(box_t __box, int __level)
 {
     long size = 1 + __level;
     
-    if (box_reallocated(__box, size)) return;
+    if (stream_reserve(__box, size)) return;
     
     void *dst = BOXB + BOXS - size;
     
@@ -85,7 +162,7 @@ void stream_close_hierarchy(box_t __box, char __char, int __level)
 {
     long size = 2 + __level;
     
-    if (box_reallocated(__box, size)) return;
+    if (stream_reserve(__box, size)) return;
     
     void *dst = BOXB + BOXS - size;
     
@@ -99,7 +176,7 @@ void stream_add_between(box_t __box, const char *__str, char __char)
     long len = strlen(__str);
     long size = 2 + len;
     
-    if (box_reallocated(__box, size)) return;
+    if (stream_reserve(__box, size)) return;
     
     void *dst = BOXB + BOXS - size;
     
@@ -108,6 +185,114 @@ void stream_add_between(box_t __box, const char *__str, char __char)
     memcpy(dst + 1 + len, &__char, 1);
 }
 
+/*
+ * Escaping writers copy the runs scan_escape() finds clean in one piece
+ * and write a replacement for each byte that stopped the scan, starting
+ * at __n, the end of the first run. A negative __len stands for a NUL
+ * terminated __str, measured by the same scan.
+ */
+#define STREAM_END(s, n, len) ((len) < 0 ? !(s)[n] : (n) == (len))
+
+static const char stream_hex[] = "0123456789abcdef";
+
+static long stream_json_escape(char *__dst, unsigned char __c)
+{
+    __dst[0] = '\\';
+    
+    switch (__c)
+    {
+        case '"': case '\\': __dst[1] = __c; return 2;
+        case '\b': __dst[1] = 'b'; return 2;
+        case '\f': __dst[1] = 'f'; return 2;
+        case '\n': __dst[1] = 'n'; return 2;
+        case '\r': __dst[1] = 'r'; return 2;
+        case '\t': __dst[1] = 't'; return 2;
+        default: break;
+    }
+    
+    memcpy(__dst + 1, "u00", 3);
+    __dst[4] = stream_hex[__c >> 4];
+    __dst[5] = stream_hex[__c & 0xF];
+    
+    return 6;
+}
+
+/*
+ * XML 1.0 has no way to write the other C0 controls, so they are
+ * dropped.
+ */
+static long stream_xml_escape(char *__dst, unsigned char __c)
+{
+    switch (__c)
+    {
+        case '&': memcpy(__dst, "&amp;", 5); return 5;
+        case '<': memcpy(__dst, "&lt;", 4); return 4;
+        case '>': memcpy(__dst, "&gt;", 4); return 4;
+        case '\t': memcpy(__dst, "&#x9;", 5); return 5;
+        case '\n': memcpy(__dst, "&#xa;", 5); return 5;
+        case '\r': memcpy(__dst, "&#xd;", 5); return 5;
+        default: return 0;
+    }
+}
+
+static void stream_escape(box_t __box, const char *__str, long __len, long __n,
+                          const char *__set, long (*__escape)(char *, unsigned char))
+{
+    char buf[8];
+    long n;
+    
+    for (;;)
+    {
+        if (__n) stream_add_length(__box, __str, __n);
+        if (STREAM_END(__str, __n, __len)) return;
+        
+        if ((n = __escape(buf, __str[__n])))
+            stream_add_length(__box, buf, n);
+        
+        __str += __n + 1;
+        if (__len > 0) __len -= __n + 1;
+        __n = scan_escape(__str, __len, __set);
+    }
+}
+
+/*
+ * Writes __len bytes of __str, or all of it up to its NUL if __len is
+ * negative, as a quoted JSON string, escaping quotes, backslashes and
+ * control characters.
+ */
+void stream_add_json_string(box_t __box, const char *__str, long __len)
+{
+    long n = scan_escape(__str, __len, STREAM_JSON_SET);
+    char *dst;
+    
+    if (STREAM_END(__str, n, __len))
+    {
+        if (stream_reserve(__box, n + 2)) return;
+        
+        dst = BOXB + BOXS - n - 2;
+        
+        dst[0] = '"';
+        memcpy(dst + 1, __str, n);
+        dst[n + 1] = '"';
+        return;
+    }
+    
+    stream_add_char(__box, '"');
+    stream_escape(__box, __str, __len, n, STREAM_JSON_SET, stream_json_escape);
+    stream_add_char(__box, '"');
+}
+
+/*
+ * Writes __str as XML character data, with __len as above. '&', '<'
+ * and '>' become entities. Tabs and line breaks become character
+ * references, since the tree parser drops them raw from values.
+ */
+void stream_add_xml_text(box_t __box, const char *__str, long __len)
+{
+    stream_escape(__box, __str, __len, scan_escape(__str, __len, STREAM_XML_SET),
+                  STREAM_XML_SET, stream_xml_escape);
+}
+
 void stream_finalize(box_t __box)
 {
     if (box_reallocated(__box, 1)) return;
@@ -137,40 +322,123 @@ int stream_save(box_t __box, const char *__path)
     return 0;
 }
 
-box_t stream_load(const char *__path)
+/*
+ * Regular files are mapped privately and read only, so the parsers read
+ * them straight from the page cache; stream_writable() lets the in situ
+ * parsers write, which copies only the pages they touch. The mapping
+ * always ends with a zero byte: the rest of the last page when there is
+ * one, or an extra anonymous page when the size is page aligned.
+ */
+static int stream_map(box_t __box, int __fd, long __size)
 {
-    FILE *file;
-    box_t __box;
-    fpos_t fs;
+    long page = sysconf(_SC_PAGESIZE);
+    int flags = MAP_PRIVATE;
+    char *map, *base = NULL;
     
-    if (!(file = fopen(__path, "r")))
-        return 0;
+    if (__size % page == 0)
+    {
+        base = mmap(NULL, __size + page, PROT_READ,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        
+        if (base == MAP_FAILED)
+            return -1;
+        
+        flags |= MAP_FIXED;
+    }
+    
+    map = mmap(base, base ? __size : __size + 1, PROT_READ, flags, __fd, 0);
+    
+    if (map == MAP_FAILED)
+    {
+        if (base) munmap(base, __size + page);
+        return -1;
+    }
+    
+    madvise(map, __size, MADV_SEQUENTIAL);
+    madvise(map, __size, MADV_WILLNEED);
+    
+    arena_free(BOXA, BOXB);
+    
+    ((long *) __box)[0] = (long) map;
+    ((long *) __box)[1] = __size + 1;
+    ((long *) __box)[3] = STREAM_MAPPED;
+    
+    return 0;
+}
+
+static int stream_read(box_t __box, int __fd)
+{
+    long len;
     
-    if (fseek(file, 0, SEEK_END))
-        goto FILE;
+    do
+    {
+        if (box_reallocated(__box, STREAM_CHUNK))
+            return -1;
+        
+        if ((len = read(__fd, BOXB + BOXS - STREAM_CHUNK, STREAM_CHUNK)) < 0)
+            return -1;
+        
+        box_reallocated(__box, len - STREAM_CHUNK);
         
-    fgetpos(file, &fs);
+    } while (len);
     
-    rewind(file);
+    if (box_reallocated(__box, 1))
+        return -1;
     
-    if(!(__box = new_stream()))
-        goto FILE;
-   
-    if (box_allocated(__box, fs + 1))
-        goto OBJ;
+    ((char *)BOXB)[BOXS - 1] = '\0';
     
-    if (fread(BOXB, 1, fs, file) != fs)
-        goto OBJ;
+    return 0;
+}
+
+int stream_writable(box_t __box)
+{
+    if (BOXM != STREAM_MAPPED)
+        return 0;
     
-    ((char *)BOXB)[fs] = '\0';
+    return mprotect(BOXB, BOXS, PROT_READ | PROT_WRITE);
+}
+
+void stream_unmap(box_t __box)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    long size = BOXS - 1;
     
-    fclose(file);
+    munmap(BOXB, size % page ? size + 1 : size + page);
+}
+
+box_t stream_load(const char *__path)
+{
+    box_t __box, arena;
+    struct stat st;
+    int fd, err;
+    
+    if ((fd = open(__path, O_RDONLY)) < 0)
+        return 0;
+    
+    arena = arena_use(0);
+    __box = new_stream();
+    arena_use(arena);
+    
+    if (!__box)
+    {
+        close(fd);
+        return 0;
+    }
+    
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+        err = stream_map(__box, fd, st.st_size) && stream_read(__box, fd);
+    else
+        err = stream_read(__box, fd);
+    
+    close(fd);
+    
+    if (err)
+    {
+        free_box(__box);
+        return 0;
+    }
     
     return __box;
-   
-OBJ: free_box(__box);
-FILE: fclose(file);
-    return 0;
 }
 
 void stream_print(box_t __box)
@@ -0,0 +1,307 @@
+//
+//  utf8.c
+//  minibox
+//
+//  Created by Antonio Angel Martínez Domínguez on 1/6/19.
+//
+//  Copyright 2019 Rokit Systems
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+
+#include <string.h>
+#include <pthread.h>
+#include "box.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86 1
+#endif
+
+/*
+ * Validation after Keiser and Lemire. Every byte is checked against the
+ * one before it by looking up the high and low nibbles of the previous
+ * byte and the high nibble of the current one in three tables whose
+ * entries hold one bit per kind of error; the third and fourth bytes of
+ * long sequences, which the tables take for stray continuations, are
+ * told apart by the bytes two and three behind. The source is taken
+ * UTF8_STEP bytes at a time and the bytes before a step are read from it
+ * directly, so only the first and the last step need a copy.
+ */
+#define UTF8_STEP 32
+
+#define UTF8_SHORT     (1 << 0)
+#define UTF8_LONG      (1 << 1)
+#define UTF8_OVERLONG3 (1 << 2)
+#define UTF8_LARGE     (1 << 3)
+#define UTF8_SURROGATE (1 << 4)
+#define UTF8_OVERLONG2 (1 << 5)
+#define UTF8_LARGE1000 (1 << 6)
+#define UTF8_OVERLONG4 (1 << 6)
+#define UTF8_CONTS     (1 << 7)
+#define UTF8_CARRY     (UTF8_SHORT | UTF8_LONG | UTF8_CONTS)
+
+#define UTF8_TAIL(p) ((p)[-1] >= 0xC0 || (p)[-2] >= 0xE0 || (p)[-3] >= 0xF0)
+
+static const unsigned char utf8_high1[16] =
+{
+    UTF8_LONG, UTF8_LONG, UTF8_LONG, UTF8_LONG,
+    UTF8_LONG, UTF8_LONG, UTF8_LONG, UTF8_LONG,
+    UTF8_CONTS, UTF8_CONTS, UTF8_CONTS, UTF8_CONTS,
+    UTF8_SHORT | UTF8_OVERLONG2,
+    UTF8_SHORT,
+    UTF8_SHORT | UTF8_OVERLONG3 | UTF8_SURROGATE,
+    UTF8_SHORT | UTF8_LARGE | UTF8_LARGE1000 | UTF8_OVERLONG4
+};
+
+static const unsigned char utf8_low1[16] =
+{
+    UTF8_CARRY | UTF8_OVERLONG3 | UTF8_OVERLONG2 | UTF8_OVERLONG4,
+    UTF8_CARRY | UTF8_OVERLONG2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_LARGE,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000,
+    UTF8_CARRY | UTF8_LARGE | UTF8_LARGE1000
+};
+
+static const unsigned char utf8_high2[16] =
+{
+    UTF8_SHORT, UTF8_SHORT, UTF8_SHORT, UTF8_SHORT,
+    UTF8_SHORT, UTF8_SHORT, UTF8_SHORT, UTF8_SHORT,
+    UTF8_LONG | UTF8_OVERLONG2 | UTF8_CONTS | UTF8_OVERLONG3 | UTF8_LARGE1000 | UTF8_OVERLONG4,
+    UTF8_LONG | UTF8_OVERLONG2 | UTF8_CONTS | UTF8_OVERLONG3 | UTF8_LARGE,
+    UTF8_LONG | UTF8_OVERLONG2 | UTF8_CONTS | UTF8_SURROGATE | UTF8_LARGE,
+    UTF8_LONG | UTF8_OVERLONG2 | UTF8_CONTS | UTF8_SURROGATE | UTF8_LARGE,
+    UTF8_SHORT, UTF8_SHORT, UTF8_SHORT, UTF8_SHORT
+};
+
+static __thread int utf8_active = 0;
+
+/*
+ * Makes the parsers of the calling thread reject input that is not
+ * UTF-8 (when __check is not zero) and returns the previous setting.
+ */
+int utf8_use(int __check)
+{
+    int prev = utf8_active;
+    utf8_active = __check != 0;
+    return prev;
+}
+
+int utf8_current(void)
+{
+    return utf8_active;
+}
+
+static int utf8_step_scalar(const unsigned char *__p)
+{
+    unsigned long w[UTF8_STEP / 8];
+    unsigned char e = 0, a;
+    int i;
+    
+    memcpy(w, __p, UTF8_STEP);
+    
+    if (!((w[0] | w[1] | w[2] | w[3]) & 0x8080808080808080UL))
+        return UTF8_TAIL(__p);
+    
+    for (i = 0; i < UTF8_STEP; i++)
+    {
+        a = __p[i - 1];
+        e |= (utf8_high1[a >> 4] & utf8_low1[a & 0x0F] & utf8_high2[__p[i] >> 4]) ^
+             (__p[i - 2] >= 0xE0 || __p[i - 3] >= 0xF0 ? 0x80 : 0);
+    }
+    
+    return e != 0;
+}
+
+#ifdef UTF8_X86
+
+#define LUT16(t) _mm_loadu_si128((const __m128i *) (t))
+#define LUT32(t) _mm256_broadcastsi128_si256(LUT16(t))
+
+__attribute__((target("ssse3")))
+static __m128i utf8_half_ssse3(const unsigned char *__p)
+{
+    const __m128i low = _mm_set1_epi8(0x0F);
+    __m128i v = _mm_loadu_si128((const __m128i *) __p);
+    __m128i p1 = _mm_loadu_si128((const __m128i *) (__p - 1));
+    __m128i p2 = _mm_loadu_si128((const __m128i *) (__p - 2));
+    __m128i p3 = _mm_loadu_si128((const __m128i *) (__p - 3));
+    __m128i e, must;
+    
+    e = _mm_and_si128(_mm_and_si128(
+            _mm_shuffle_epi8(LUT16(utf8_high1), _mm_and_si128(_mm_srli_epi16(p1, 4), low)),
+            _mm_shuffle_epi8(LUT16(utf8_low1), _mm_and_si128(p1, low))),
+            _mm_shuffle_epi8(LUT16(utf8_high2), _mm_and_si128(_mm_srli_epi16(v, 4), low)));
+    
+    must = _mm_or_si128(_mm_subs_epu8(p2, _mm_set1_epi8((char) (0xE0 - 0x80))),
+                        _mm_subs_epu8(p3, _mm_set1_epi8((char) (0xF0 - 0x80))));
+    
+    return _mm_xor_si128(e, _mm_and_si128(must, _mm_set1_epi8((char) 0x80)));
+}
+
+__attribute__((target("ssse3")))
+static int utf8_step_ssse3(const unsigned char *__p)
+{
+    __m128i a = _mm_loadu_si128((const __m128i *) __p);
+    __m128i b = _mm_loadu_si128((const __m128i *) (__p + 16));
+    
+    if (!_mm_movemask_epi8(_mm_or_si128(a, b)))
+        return UTF8_TAIL(__p);
+    
+    a = _mm_or_si128(utf8_half_ssse3(__p), utf8_half_ssse3(__p + 16));
+    
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())) != 0xFFFF;
+}
+
+__attribute__((target("avx2")))
+static int utf8_step_avx2(const unsigned char *__p)
+{
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i v = _mm256_loadu_si256((const __m256i *) __p);
+    __m256i p1, p2, p3, e, must;
+    
+    if (!_mm256_movemask_epi8(v))
+        return UTF8_TAIL(__p);
+    
+    p1 = _mm256_loadu_si256((const __m256i *) (__p - 1));
+    p2 = _mm256_loadu_si256((const __m256i *) (__p - 2));
+    p3 = _mm256_loadu_si256((const __m256i *) (__p - 3));
+    
+    e = _mm256_and_si256(_mm256_and_si256(
+            _mm256_shuffle_epi8(LUT32(utf8_high1), _mm256_and_si256(_mm256_srli_epi16(p1, 4), low)),
+            _mm256_shuffle_epi8(LUT32(utf8_low1), _mm256_and_si256(p1, low))),
+            _mm256_shuffle_epi8(LUT32(utf8_high2), _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+    
+    must = _mm256_or_si256(_mm256_subs_epu8(p2, _mm256_set1_epi8((char) (0xE0 - 0x80))),
+                           _mm256_subs_epu8(p3, _mm256_set1_epi8((char) (0xF0 - 0x80))));
+    
+    e = _mm256_xor_si256(e, _mm256_and_si256(must, _mm256_set1_epi8((char) 0x80)));
+    
+    return !_mm256_testz_si256(e, e);
+}
+
+#endif
+
+static int (*utf8_step)(const unsigned char *) = NULL;
+static pthread_once_t utf8_once = PTHREAD_ONCE_INIT;
+
+static void utf8_select(void)
+{
+#ifdef UTF8_X86
+    __builtin_cpu_init();
+    
+    if (__builtin_cpu_supports("avx2"))
+        utf8_step = utf8_step_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        utf8_step = utf8_step_ssse3;
+    else
+#endif
+        utf8_step = utf8_step_scalar;
+}
+
+/*
+ * Checks the whole steps of __src from *__pos up to __end and, when
+ * __last, what is left after them, moving *__pos past what was checked.
+ * A sequence cut by __end is only complete or not once __last is given,
+ * so callers that see the source in windows pass the window end and
+ * finish with the source end. Returns -1 if anything checked is invalid.
+ */
+int utf8_range(const char *__src, long *__pos, long __end, int __last)
+{
+    const unsigned char *src = (const unsigned char *) __src;
+    unsigned char tmp[3 + UTF8_STEP];
+    long p = *__pos, n;
+    int e = 0;
+    
+    pthread_once(&utf8_once, utf8_select);
+    
+    if (!p && __end >= UTF8_STEP)
+    {
+        memset(tmp, 0, 3);
+        memcpy(tmp + 3, src, UTF8_STEP);
+        e = utf8_step(tmp + 3);
+        p = UTF8_STEP;
+    }
+    
+    for (; !e && p + UTF8_STEP <= __end; p += UTF8_STEP)
+        e = utf8_step(src + p);
+    
+    if (!e && __last)
+    {
+        n = p < 3 ? p : 3;
+        
+        memset(tmp, 0, sizeof(tmp));
+        memcpy(tmp + 3 - n, src + p - n, n + __end - p);
+        
+        e = utf8_step(tmp + 3);
+        p = __end;
+    }
+    
+    *__pos = p;
+    
+    return e ? -1 : 0;
+}
+
+int utf8_check(const char *__src, long __len)
+{
+    long pos = 0;
+    
+    return utf8_range(__src, &pos, __len, 1);
+}
+
+/*
+ * Writes the UTF-8 form of the code point __cp and returns its length.
+ */
+int utf8_encode(char *__dst, unsigned __cp)
+{
+    unsigned char *d = (unsigned char *) __dst;
+    
+    if (__cp < 0x80)
+    {
+        d[0] = __cp;
+        return 1;
+    }
+    
+    if (__cp < 0x800)
+    {
+        d[0] = 0xC0 | __cp >> 6;
+        d[1] = 0x80 | (__cp & 0x3F);
+        return 2;
+    }
+    
+    if (__cp < 0x10000)
+    {
+        d[0] = 0xE0 | __cp >> 12;
+        d[1] = 0x80 | (__cp >> 6 & 0x3F);
+        d[2] = 0x80 | (__cp & 0x3F);
+        return 3;
+    }
+    
+    d[0] = 0xF0 | __cp >> 18;
+    d[1] = 0x80 | (__cp >> 12 & 0x3F);
+    d[2] = 0x80 | (__cp >> 6 & 0x3F);
+    d[3] = 0x80 | (__cp & 0x3F);
+    return 4;
+}
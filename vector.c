@@ -0,0 +1,243 @@
+//
+//  vector.c
+//  minibox
+//
+//  Created by Antonio Angel Martínez Domínguez on 1/6/19.
+//
+//  Copyright 2019 Rokit Systems
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include "box.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VECTOR_X86 1
+#endif
+
+#define VECTOR_LANES 16
+
+/*
+ * Reductions over packed number arrays. Every kernel keeps VECTOR_LANES
+ * partial results, lane j taking the elements whose index is j modulo
+ * VECTOR_LANES, and the lanes are folded in one fixed order, so results
+ * are the same bits whichever kernel runs. Min and max follow the SSE
+ * rule (a < b ? a : b), so NaN elements give an unspecified result.
+ * Packed integer arrays are reduced from their slots, each INT48 payload
+ * converted to the double it holds exactly.
+ */
+
+#define VECTOR_LOOP(expr) \
+    for (i = 0; i < __n; i += VECTOR_LANES) \
+        for (j = 0; j < VECTOR_LANES; j++) \
+            __lanes[j] = (expr);
+
+#define VECTOR_MIN2(a, b) ((a) < (b) ? (a) : (b))
+#define VECTOR_MAX2(a, b) ((a) > (b) ? (a) : (b))
+#define VECTOR_INT48(v) ((double) VALUE_INT48(v))
+
+static void vector_lanes_scalar(int __op, const double *__a, const double *__b, long __n, double *__lanes)
+{
+    long i;
+    int j;
+    
+    switch (__op)
+    {
+        case VECTOR_SUM: VECTOR_LOOP(__lanes[j] + __a[i + j]) break;
+        case VECTOR_MIN: VECTOR_LOOP(VECTOR_MIN2(__lanes[j], __a[i + j])) break;
+        case VECTOR_MAX: VECTOR_LOOP(VECTOR_MAX2(__lanes[j], __a[i + j])) break;
+        case VECTOR_DOT: VECTOR_LOOP(__lanes[j] + __a[i + j] * __b[i + j]) break;
+        default: break;
+    }
+}
+
+static void vector_lanes_int48_scalar(int __op, const value_t *__a, const value_t *__b, long __n, double *__lanes)
+{
+    long i;
+    int j;
+    
+    switch (__op)
+    {
+        case VECTOR_SUM: VECTOR_LOOP(__lanes[j] + VECTOR_INT48(__a[i + j])) break;
+        case VECTOR_MIN: VECTOR_LOOP(VECTOR_MIN2(__lanes[j], VECTOR_INT48(__a[i + j]))) break;
+        case VECTOR_MAX: VECTOR_LOOP(VECTOR_MAX2(__lanes[j], VECTOR_INT48(__a[i + j]))) break;
+        case VECTOR_DOT:
+            VECTOR_LOOP(__lanes[j] + VECTOR_INT48(__a[i + j]) * VECTOR_INT48(__b[i + j]))
+            break;
+        default: break;
+    }
+}
+
+#ifdef VECTOR_X86
+
+#define AVX_LOOP(load, expr) \
+    for (i = 0; i < __n; i += VECTOR_LANES) \
+        for (k = 0; k < 4; k++) \
+        { \
+            __m256d x = load(__a + i + k * 4); \
+            acc[k] = (expr); \
+        }
+
+__attribute__((target("avx2")))
+static void vector_lanes_avx2(int __op, const double *__a, const double *__b, long __n, double *__lanes)
+{
+    __m256d acc[4];
+    long i;
+    int k;
+    
+    for (k = 0; k < 4; k++)
+        acc[k] = _mm256_loadu_pd(__lanes + k * 4);
+    
+    switch (__op)
+    {
+        case VECTOR_SUM: AVX_LOOP(_mm256_loadu_pd, _mm256_add_pd(acc[k], x)) break;
+        case VECTOR_MIN: AVX_LOOP(_mm256_loadu_pd, _mm256_min_pd(acc[k], x)) break;
+        case VECTOR_MAX: AVX_LOOP(_mm256_loadu_pd, _mm256_max_pd(acc[k], x)) break;
+        case VECTOR_DOT:
+            AVX_LOOP(_mm256_loadu_pd,
+                     _mm256_add_pd(acc[k], _mm256_mul_pd(x, _mm256_loadu_pd(__b + i + k * 4))))
+            break;
+        default: break;
+    }
+    
+    for (k = 0; k < 4; k++)
+        _mm256_storeu_pd(__lanes + k * 4, acc[k]);
+}
+
+/*
+ * Four INT48 slots as doubles: the payload, biased into [0, 2^48) by
+ * flipping its sign bit, is added to the bits of 1.5 * 2^52, which puts
+ * the integer in the low mantissa bits; subtracting 1.5 * 2^52 back
+ * leaves it exactly.
+ */
+__attribute__((target("avx2")))
+static inline __m256d vector_int48_avx2(const value_t *__p)
+{
+    const __m256i payload = _mm256_set1_epi64x(VALUE_PAYLOAD);
+    const __m256i sign = _mm256_set1_epi64x(1L << 47);
+    const __m256i bias = _mm256_set1_epi64x(0x4338000000000000L - (1L << 47));
+    __m256i v = _mm256_loadu_si256((const __m256i *) __p);
+    
+    v = _mm256_add_epi64(_mm256_xor_si256(_mm256_and_si256(v, payload), sign), bias);
+    
+    return _mm256_sub_pd(_mm256_castsi256_pd(v), _mm256_set1_pd(0x1.8p52));
+}
+
+__attribute__((target("avx2")))
+static void vector_lanes_int48_avx2(int __op, const value_t *__a, const value_t *__b, long __n, double *__lanes)
+{
+    __m256d acc[4];
+    long i;
+    int k;
+    
+    for (k = 0; k < 4; k++)
+        acc[k] = _mm256_loadu_pd(__lanes + k * 4);
+    
+    switch (__op)
+    {
+        case VECTOR_SUM: AVX_LOOP(vector_int48_avx2, _mm256_add_pd(acc[k], x)) break;
+        case VECTOR_MIN: AVX_LOOP(vector_int48_avx2, _mm256_min_pd(acc[k], x)) break;
+        case VECTOR_MAX: AVX_LOOP(vector_int48_avx2, _mm256_max_pd(acc[k], x)) break;
+        case VECTOR_DOT:
+            AVX_LOOP(vector_int48_avx2,
+                     _mm256_add_pd(acc[k], _mm256_mul_pd(x, vector_int48_avx2(__b + i + k * 4))))
+            break;
+        default: break;
+    }
+    
+    for (k = 0; k < 4; k++)
+        _mm256_storeu_pd(__lanes + k * 4, acc[k]);
+}
+
+#endif
+
+static void (*vector_lanes)(int, const double *, const double *, long, double *) = NULL;
+static void (*vector_lanes_int48)(int, const value_t *, const value_t *, long, double *) = NULL;
+static pthread_once_t vector_once = PTHREAD_ONCE_INIT;
+
+static void vector_select(void)
+{
+#ifdef VECTOR_X86
+    __builtin_cpu_init();
+    
+    if (__builtin_cpu_supports("avx2"))
+    {
+        vector_lanes = vector_lanes_avx2;
+        vector_lanes_int48 = vector_lanes_int48_avx2;
+        return;
+    }
+#endif
+    
+    vector_lanes = vector_lanes_scalar;
+    vector_lanes_int48 = vector_lanes_int48_scalar;
+}
+
+static double vector_step(int __op, double __r, double __x)
+{
+    switch (__op)
+    {
+        case VECTOR_MIN: return VECTOR_MIN2(__r, __x);
+        case VECTOR_MAX: return VECTOR_MAX2(__r, __x);
+        default: return __r + __x;
+    }
+}
+
+static double vector_at(const void *__v, long __i, int __int48)
+{
+    return __int48 ? VECTOR_INT48(((const value_t *) __v)[__i]) : ((const double *) __v)[__i];
+}
+
+static double vector_run(int __op, const void *__a, const void *__b, long __n, int __int48)
+{
+    double lanes[VECTOR_LANES], r;
+    long i, body = __n - __n % VECTOR_LANES;
+    int j;
+    
+    pthread_once(&vector_once, vector_select);
+    
+    if ((__op == VECTOR_MIN || __op == VECTOR_MAX) && !__n)
+        return NAN;
+    
+    for (j = 0; j < VECTOR_LANES; j++)
+        lanes[j] = __op == VECTOR_MIN || __op == VECTOR_MAX ? vector_at(__a, 0, __int48) : 0;
+    
+    if (body && __int48)
+        vector_lanes_int48(__op, __a, __b, body, lanes);
+    else if (body)
+        vector_lanes(__op, __a, __b, body, lanes);
+    
+    r = lanes[0];
+    
+    for (j = 1; j < VECTOR_LANES; j++)
+        r = vector_step(__op, r, lanes[j]);
+    
+    for (i = body; i < __n; i++)
+        r = vector_step(__op, r, __op == VECTOR_DOT ?
+                        vector_at(__a, i, __int48) * vector_at(__b, i, __int48) :
+                        vector_at(__a, i, __int48));
+    
+    return r;
+}
+
+double vector_reduce(int __op, const double *__a, const double *__b, long __n)
+{
+    return vector_run(__op, __a, __b, __n, 0);
+}
+
+double vector_reduce_int48(int __op, const value_t *__a, const value_t *__b, long __n)
+{
+    return vector_run(__op, __a, __b, __n, 1);
+}
@@ -19,6 +19,7 @@
 //  limitations under the License.
 //
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include "box.h"
@@ -26,6 +27,9 @@
 #define XML_FORMAT_ERROR "Invalid xml format."
 #define STRING_TRIM(s) while (*s > 0x0 && *s < 0x21) ++s
 #define case_0(x) case 0x0: ERROR(XML_FORMAT_ERROR, x)
+#define IS_TRIM(c) ((c) > 0x0 && (c) < 0x21)
+#define XML_CHUNK 0x10000
+#define XML_FRAMES 0x20
 #define case_trim case 0x8: case 0x9: case 0xA: \
 case 0xB: case 0xC: case 0xD: case 0x20:
 
@@ -44,7 +48,6 @@ enum {
 typedef struct
 {
     const char *src;
-    const char *key;
     unsigned size;
     signed type;
 } tok_t;
@@ -55,16 +58,18 @@ typedef struct
     const char *ptr;
     signed level;
     tok_t token;
+    const path_t *path;
+    long depth;
 } xml_t;
 
-void object_xml(box_t __box, box_t __str, int *level);
-void array_xml(box_t __box, box_t __str, int *level);
+void object_xml(box_t __box, box_t __str, int *__level);
+void object_xml_compact(box_t __box, box_t __str);
 
-const char* xml_parse_start(box_t __box, const char *__src);
+const char* xml_parse_start(box_t __box, const char *__src, const path_t *__path);
 const char* xml_parse_header(const char *__src);
 const char* xml_parse_doctype(const char *__src);
 
-box_t xml_object_from_string(const char *__src)
+static box_t xml_object(const char *__src, const path_t *__path)
 {
     box_t box = new_object();
     const char *ptr = __src;
@@ -78,14 +83,21 @@ box_t xml_object_from_string(const char *__src)
             {
                 case '?': ptr = xml_parse_header(ptr); break;
                 case '!': ptr = xml_parse_doctype(ptr); break;
-                default : ptr = xml_parse_start(box, --ptr); break;
+                default : ptr = xml_parse_start(box, --ptr, __path); break;
             }
+                
+                if (!ptr)
+                {
+                    free_box(box);
+                    return 0;
+                }
                 break;
             case_trim
                 break;
                 
             default:
                 ERROR(XML_FORMAT_ERROR, "xml_object_from_string()")
+                free_box(box);
                 return 0;
         }
         
@@ -94,9 +106,34 @@ box_t xml_object_from_string(const char *__src)
     return box;
 }
 
+box_t xml_object_from_string(const char *__src)
+{
+    return xml_object(__src, NULL);
+}
+
+/*
+ * Paths name elements and attributes below the root element, as in
+ * "user.id"; item selectors ("[*]") are accepted and ignored, repeated
+ * elements being lists already.
+ */
+box_t xml_object_from_string_paths(const char *__src, const char **__paths)
+{
+    path_t *path;
+    box_t box;
+    
+    if (!(path = path_compile(__paths, 0)))
+        return 0;
+    
+    box = xml_object(__src, path);
+    
+    path_free(path);
+    
+    return box;
+}
+
 box_t xml_object_from_file(const char *__path)
 {
-    box_t str;
+    box_t str, box;
     
     if (!(str = stream_load(__path)))
     {
@@ -104,20 +141,44 @@ box_t xml_object_from_file(const char *__path)
         return 0;
     }
     
-    return xml_object_from_string(box_buffer(str));
+    box = xml_object_from_string(box_buffer(str));
+    
+    free_box(str);
+    
+    return box;
 }
 
-box_t xml_stream_from_object(box_t __box)
+void xml_write_object(box_t __box, box_t __stream, int __format)
 {
-    box_t str = new_stream();
     int level = 0;
     
-    stream_add(str, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-    stream_add(str, "<!-- XML document created with MiniBox API -->\n");
-    stream_add(str, "<object>");
+    if (__format == MINIBOX_FORMAT_COMPACT)
+    {
+        stream_add(__stream, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+        stream_add(__stream, "<object>");
+        object_xml_compact(__box, __stream);
+        stream_add(__stream, "</object>");
+        return;
+    }
+    
+    stream_add(__stream, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    stream_add(__stream, "<!-- XML document created with MiniBox API -->\n");
+    stream_add(__stream, "<object>");
+    
+    object_xml(__box, __stream, &level);
+    stream_add(__stream, "</object>");
+}
+
+box_t xml_stream_from_object(box_t __box)
+{
+    return xml_stream_from_object_format(__box, MINIBOX_FORMAT_PRETTY);
+}
+
+box_t xml_stream_from_object_format(box_t __box, int __format)
+{
+    box_t str = new_stream();
     
-    object_xml(__box, str, &level);
-    stream_add(str, "</object>");
+    xml_write_object(__box, str, __format);
     
     stream_finalize(str);
     
@@ -126,16 +187,33 @@ box_t xml_stream_from_object(box_t __box)
 
 int xml_file_from_object(box_t __box, const char *__path)
 {
+    return xml_file_from_object_format(__box, __path, MINIBOX_FORMAT_PRETTY);
+}
+
+int xml_file_from_object_format(box_t __box, const char *__path, int __format)
+{
+    FILE *file;
     box_t str = 0;
+    int err;
     
-    EIF(!(str = xml_stream_from_object(__box)),
-        XML_FORMAT_ERROR, "xml_file_from_object()")
-    
-    EIF(stream_save(str, __path),
+    EIF(!(file = fopen(__path, "w")),
         BOX_CREATE_ERROR, "xml_file_from_object()")
     
+    if (!(str = new_stream_file(file)))
+    {
+        fclose(file);
+        ERROR(BOX_CREATE_ERROR, "xml_file_from_object()")
+        return -1;
+    }
+    
+    xml_write_object(__box, str, __format);
+    
+    err = stream_flush(str);
     free_box(str);
     
+    EIF(fclose(file) || err,
+        BOX_CREATE_ERROR, "xml_file_from_object()")
+    
     return 0;
 }
 
@@ -229,10 +307,10 @@ static int xml_next(xml_t *__xml)
                 
             case ' ':
                 
-                if (src)
-                    ptr = xml_attr_end(ptr, &type, &level);
-                else
+                if (!src)
                     size++;
+                else if (!(ptr = xml_attr_end(ptr, &type, &level)))
+                    return -1;
                 break;
                 
             default:
@@ -250,90 +328,122 @@ static int xml_next(xml_t *__xml)
     return 0;
 }
 
-static int xml_is_array(xml_t *__xml)
+static char* xml_copy_key(tok_t *__tkn)
 {
-    switch (__xml->token.type)
+    char *key;
+    
+    if (!(key = arena_alloc(arena_current(), __tkn->size + 1)))
     {
-        case XML_OBJECT:
-        case XML_ATTRIBUTE_OPEN:
-        case XML_ATTRIBUTE_CLOSE:
-            break;
-        default:
-            WARNING(XML_FORMAT_ERROR, "xml_is_array()")
-            return 0;
+        ERROR(BOX_MEMORY_ERROR, "xml_copy_key()")
+        return NULL;
     }
+    memcpy(key, __tkn->src, __tkn->size);
+    key[__tkn->size] = 0;
+    
+    return key;
+}
 
-    xml_t xml = *__xml;
-    const char *key = NULL;
-    signed level = xml.level;
-    int levOk = 0;
+/*
+ * Length of the entity or character reference at __src, whose code
+ * point is stored in __cp, or 0 if there is none.
+ */
+static long xml_entity(const char *__src, const char *__end, unsigned *__cp)
+{
+    static const struct { const char *name; long len; char c; } named[] = {
+        { "&amp;", 5, '&' }, { "&lt;", 4, '<' }, { "&gt;", 4, '>' },
+        { "&quot;", 6, '"' }, { "&apos;", 6, '\'' }
+    };
+    const char *p = __src + 1, *digits;
+    unsigned long cp = 0;
+    int i, base = 10, d;
     
-    do
-    {
-        if (xml_next(&xml)) return -1;
-        
-        switch (xml.token.type)
+    for (i = 0; i < 5; i++)
+        if (__end - __src >= named[i].len && !memcmp(__src, named[i].name, named[i].len))
         {
-            case XML_ATTRIBUTE_CLOSE:
-                levOk = xml.level == level;
-                break;
-            case XML_ATTRIBUTE_OPEN:
-            case XML_OBJECT:
-            case XML_LABEL:
-                levOk = xml.level == level +1;
-                break;
-            default: levOk = 0; break;
+            *__cp = named[i].c;
+            return named[i].len;
         }
+    
+    if (p == __end || *p++ != '#') return 0;
+    if (p < __end && *p == 'x') base = 16, p++;
+    
+    for (digits = p; p < __end && *p != ';'; p++)
+    {
+        if (*p >= '0' && *p <= '9')
+            d = *p - '0';
+        else if (base == 16 && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+            d = (*p | 0x20) - 'a' + 10;
+        else
+            return 0;
         
-        if (levOk) {
-            if (key)
-                return !memcmp(key, xml.token.src, xml.token.size);
-            
-            __xml->token.key = key = xml.token.src;
-        }
-    } while (level <= xml.level);
+        if ((cp = cp * base + d) > 0x10FFFF) return 0;
+    }
     
-    return 0;
+    if (p == __end || p == digits || !cp || (cp >= 0xD800 && cp < 0xE000))
+        return 0;
+    
+    *__cp = (unsigned) cp;
+    
+    return p + 1 - __src;
 }
 
-static char* xml_copy_key(tok_t *__tkn)
+/*
+ * Replaces the entities and character references of __len bytes at
+ * __src, writing to __dst, which may be __src since none is shorter than
+ * its UTF-8 encoding, and returns the new length. An '&' that starts
+ * neither is kept as it is.
+ */
+static long xml_unescape(char *__dst, const char *__src, long __len)
 {
-    char *key;
+    const char *end = __src + __len, *p;
+    char *d = __dst;
+    unsigned cp;
+    long n;
     
-    if (!(key = malloc(__tkn->size + 1)))
+    while ((p = memchr(__src, '&', end - __src)))
     {
-        ERROR(BOX_MEMORY_ERROR, "xml_copy_key()")
-        return NULL;
+        memmove(d, __src, p - __src);
+        d += p - __src;
+        
+        if ((n = xml_entity(p, end, &cp)))
+        {
+            d += utf8_encode(d, cp);
+            __src = p + n;
+        }
+        else
+        {
+            *d++ = '&';
+            __src = p + 1;
+        }
     }
-    memcpy(key, __tkn->src, __tkn->size);
-    key[__tkn->size] = 0;
     
-    return key;
+    memmove(d, __src, end - __src);
+    
+    return d - __dst + (end - __src);
 }
 
-static char * xml_array_key(xml_t *__xml)
+static char * xml_array_key(const char *__name)
 {
     char *key;
-    tok_t *t = &__xml->token;
-    const char *ptr = t->key;
+    const char *ptr = __name;
     long l = 0, s = 0;
     
     while (*ptr != ' ' && *ptr != '>') ptr++;
     
-    l = ptr - t->key;
+    l = ptr - __name;
     
-    if ((*t->key + l) == 's')
+    if ((*__name + l) == 's')
         s = l + 1;
     else
         s = l + 2;
     
-    if (!(key = malloc(s)))
+    if (!(key = arena_alloc(arena_current(), s)))
     {
         ERROR(BOX_MEMORY_ERROR, "xml_array_key()")
         return NULL;
     }
     
-    memcpy(key, t->key, l);
+    memcpy(key, __name, l);
     
     key[s-2] = 's';
     key[s-1] = 0;
@@ -438,7 +548,7 @@ static int xml_attributes(box_t __box, xml_t *__xml)
             
         } while (!ok);
         
-        EIF(!(key = malloc(len + 1)),
+        EIF(!(key = arena_alloc(arena_current(), len + 1)),
             BOX_MEMORY_ERROR, "xml_attributes()")
 
         memcpy(key, src, len);
@@ -450,6 +560,7 @@ static int xml_attributes(box_t __box, xml_t *__xml)
         do { switch (*ptr++) {
                 
             case_0("xml_attributes()") /* end */
+                arena_free(arena_current(), key);
                 return - 1;
                 
             case 0x27: /* ' */
@@ -462,12 +573,22 @@ static int xml_attributes(box_t __box, xml_t *__xml)
                 break;
         } } while (ok != 2);
         
-        EIF(!(val = malloc(len + 1)),
+        EIF(!(val = arena_alloc(arena_current(), len + 1)),
             XML_FORMAT_ERROR, "xml_attributes()")
    
         memcpy(val, src, len);
         val[len] = 0;
         
+        if (memchr(val, '&', len))
+            val[xml_unescape(val, val, len)] = 0;
+        
+        if (__xml->path && !path_key(__xml->path, key, strlen(key)))
+        {
+            arena_free(arena_current(), key);
+            arena_free(arena_current(), val);
+            continue;
+        }
+        
         object_put_string(__box,
                           MINIBOX_MEMORY_RELEASE, key,
                           MINIBOX_MEMORY_RELEASE, val);
@@ -476,277 +597,355 @@ static int xml_attributes(box_t __box, xml_t *__xml)
     return 0;
 }
 
-int xml_object(box_t __box, xml_t *__xml);
+typedef union
+{
+    double number;
+    long integer;
+    long boolean;
+    char *string;
+    box_t box;
+    value_t slot;
+} xml_value_t;
 
-int xml_array(box_t __box, xml_t *__xml)
+static long xml_text(tok_t *__tkn, xml_value_t *__value)
+{
+    char *s;
+    long len;
+    
+    if (!(s = xml_copy_key(__tkn))) return 0;
+    
+    s[len = xml_unescape(s, s, __tkn->size)] = 0;
+    
+    if (len > VALUE_SHORT_MAX)
+    {
+        __value->string = s;
+        return MINIBOX_TPAR_STRING;
+    }
+    
+    __value->slot = box_short(s, len);
+    arena_free(arena_current(), s);
+    
+    return MINIBOX_SHORT_STRING;
+}
+
+static long xml_value(tok_t *__tkn, xml_value_t *__value)
+{
+    switch (xml_value_type(__tkn))
+    {
+        case MINIBOX_TYPE_NUMBER:
+            if (number_integer(__tkn->src, &__value->integer) == __tkn->size)
+                return MINIBOX_TYPE_INTEGER;
+            
+            if (number_parse(__tkn->src, &__value->number) == __tkn->size)
+                return MINIBOX_TYPE_NUMBER;
+            
+            /* "-" or "-." look numeric but are kept as text */
+            
+        case MINIBOX_TYPE_STRING:
+            if (memchr(__tkn->src, '&', __tkn->size))
+                return xml_text(__tkn, __value);
+            
+            if (__tkn->size <= VALUE_SHORT_MAX)
+            {
+                __value->slot = box_short(__tkn->src, __tkn->size);
+                return MINIBOX_SHORT_STRING;
+            }
+            if (!(__value->string = xml_copy_key(__tkn))) return 0;
+            return MINIBOX_TPAR_STRING;
+            
+        case MINIBOX_TRUE:
+            __value->boolean = 1;
+            return MINIBOX_TYPE_BOOLEAN;
+            
+        case MINIBOX_FALSE:
+            __value->boolean = 0;
+            return MINIBOX_TYPE_BOOLEAN;
+            
+        case MINIBOX_TYPE_NULL:
+            __value->boolean = 0;
+            return MINIBOX_TYPE_NULL;
+            
+        default: return 0;
+    }
+}
+
+static void xml_store(box_t __box, box_t __arr, char *__key, long __type, xml_value_t *__value)
+{
+    if (__arr)
+        array_add(__arr, __value, __type);
+    else if (__key)
+        object_put(__box, __key, MINIBOX_MEMORY_RELEASE, __value, __type);
+    else if (__type == MINIBOX_TPAR_STRING)
+        arena_free(arena_current(), __value->string);
+}
+
+/*
+ * Reads the children of the element just opened into *__box, in a single
+ * pass over an explicit stack with a frame per open element. The first
+ * child is held back until the second one shows up: if both share the
+ * tag the element is a list and every child goes to an array, which
+ * replaces the element's box or, for the root and for elements with
+ * attributes (keyed), is put in it under the plural of the tag.
+ */
+typedef struct
 {
     box_t box;
-    int level = __xml->level;
+    box_t arr;
+    const path_t *path;
+    const char *first;
+    char *key;
+    char *hkey;
+    xml_value_t hval;
+    long held;
+    long count;
+    unsigned size;
+    int level;
+    int keyed;
+} xml_frame_t;
+
+static void xml_frame(xml_frame_t *__f, box_t __box, xml_t *__xml, int __keyed)
+{
+    memset(__f, 0, sizeof(xml_frame_t));
+    __f->box = __box;
+    __f->path = __xml->path;
+    __f->level = __xml->level;
+    __f->keyed = __keyed;
+}
+
+static void xml_child(xml_frame_t *__f, box_t __box)
+{
+    xml_value_t value;
+    long type = box_type(__box) + MINIBOX_MEMORY_RELEASE;
     
-    do
+    value.box = __box;
+    
+    if (__f->count == 1 && !__f->arr)
     {
-        if (xml_next(__xml)) return -1;
+        __f->hkey = __f->key;
+        __f->hval = value;
+        __f->held = type;
+    }
+    else xml_store(__f->box, __f->arr, __f->key, type, &value);
+    
+    __f->key = NULL;
+}
+
+static void xml_drop(xml_frame_t *__f)
+{
+    box_t arena = arena_current();
+    
+    arena_free(arena, __f->key);
+    
+    if (!__f->held) return;
+    
+    arena_free(arena, __f->hkey);
+    
+    if (__f->held == MINIBOX_TPAR_STRING)
+        arena_free(arena, __f->hval.string);
+    else if (__f->held == MINIBOX_TPAR_OBJECT || __f->held == MINIBOX_TPAR_ARRAY)
+        free_box(__f->hval.box);
+}
+
+static int xml_children(box_t *__box, xml_t *__xml, int __keyed)
+{
+    xml_frame_t frames[XML_FRAMES], *stack = frames, *f = frames, *tmp;
+    long depth = 1, max = XML_FRAMES, type;
+    tok_t *t = &__xml->token;
+    const path_t *sub = NULL;
+    xml_value_t value;
+    box_t box;
+    int r = -1;
+    
+    xml_frame(f, *__box, __xml, __keyed);
+    
+    for (;;)
+    {
+        if (xml_next(__xml)) goto done;
         
-        switch (__xml->token.type)
+        switch (t->type)
         {
             case XML_VALUE:
                 
-                switch (xml_value_type(&__xml->token))
+                if (!(type = xml_value(t, &value)))
+                    break;
+                
+                if (f->count == 1 && !f->held && !f->arr)
                 {
-                    case MINIBOX_TYPE_NUMBER: {
-                        double value = atof(__xml->token.src);
-                        array_add_number(__box, value);
-                    }   break;
-                    case MINIBOX_TYPE_STRING: {
-                        char *str = xml_copy_key(&__xml->token);
-                        array_add_string(__box, MINIBOX_MEMORY_RELEASE, str);
-                    }   break;
-                    case MINIBOX_TRUE:
-                        array_add_boolean(__box, 1);
-                        break;
-                    case MINIBOX_FALSE:
-                        array_add_boolean(__box, 0);
-                        break;
-                    case MINIBOX_TYPE_NULL:
-                        array_add_null(__box);
-                        break;
-                    default: break;
+                    f->hkey = f->key;
+                    f->hval = value;
+                    f->held = type;
                 }
+                else xml_store(f->box, f->arr, f->key, type, &value);
+                
+                f->key = NULL;
                 break;
                 
+            case XML_LABEL:
+            case XML_OBJECT:
             case XML_ATTRIBUTE_OPEN:
+            case XML_ATTRIBUTE_CLOSE:
                 
-                if (xml_is_array(__xml))
+                if (f->path && !(sub = path_key(f->path, t->src, t->size)))
                 {
-                    box_t arr;
-                    char *key;
-                    EIF(!(key = xml_array_key(__xml)),
-                        XML_FORMAT_ERROR, "xml_array")
-                    EIF(!(box = new_object()),
-                        BOX_CREATE_ERROR, "xml_array")
-                    EIF(xml_attributes(box, __xml),
-                        XML_FORMAT_ERROR, "xml_array")
-                    EIF(!(arr = new_array()),
-                        BOX_CREATE_ERROR, "xml_array")
-                    EIF(xml_array(arr, __xml),
-                        XML_FORMAT_ERROR, "xml_array")
-                    
-                    object_put_box(box,
-                                   MINIBOX_MEMORY_RELEASE, key,
-                                   MINIBOX_MEMORY_RELEASE, arr);
-                } else {
-                    
-                    EIF(!(box = new_object()),
-                        BOX_CREATE_ERROR, "xml_array")
-                    EIF(xml_attributes(box, __xml),
-                        XML_FORMAT_ERROR, "xml_array")
-                    EIF(xml_object(box, __xml),
-                        XML_FORMAT_ERROR, "xml_array")
+                    while (__xml->level > f->level)
+                        if (xml_next(__xml)) goto done;
+                    break;
                 }
-                array_add_box(__box,
-                              MINIBOX_MEMORY_RELEASE, box);
-                break;
-                
-            case XML_ATTRIBUTE_CLOSE:
-                
-                EIF(!(box = new_object()),
-                    BOX_CREATE_ERROR, "xml_array")
-                EIF(xml_attributes(box, __xml),
-                    XML_FORMAT_ERROR, "xml_array")
-                array_add_box(__box,
-                              MINIBOX_MEMORY_RELEASE, box);
-                break;
                 
-            case XML_OBJECT:
-                
-                if (xml_is_array(__xml))
+                if (!f->arr && ++f->count == 1)
                 {
-                    EIF(!(box = new_array()),
-                        BOX_CREATE_ERROR, "xml_array")
-                    EIF(xml_array(box, __xml),
-                        XML_FORMAT_ERROR, "xml_array")
-                } else {
-                    EIF(!(box = new_object()),
-                        BOX_CREATE_ERROR, "xml_array")
-                    EIF(xml_object(box, __xml),
-                        XML_FORMAT_ERROR, "xml_array")
+                    f->first = t->src;
+                    f->size = t->size;
+                }
+                else if (!f->arr && f->count == 2)
+                {
+                    if (f->size == t->size && !memcmp(f->first, t->src, f->size))
+                    {
+                        if (!(f->arr = new_array()))
+                        {
+                            ERROR(BOX_CREATE_ERROR, "xml_children")
+                            goto done;
+                        }
+                        
+                        if (f->held) array_add(f->arr, &f->hval, f->held);
+                        arena_free(arena_current(), f->hkey);
+                        
+                        if (f->keyed)
+                        {
+                            if (!(f->key = xml_array_key(f->first)))
+                            {
+                                ERROR(BOX_MEMORY_ERROR, "xml_children")
+                                goto done;
+                            }
+                            
+                            object_put_box(f->box,
+                                           MINIBOX_MEMORY_RELEASE, f->key,
+                                           MINIBOX_MEMORY_RELEASE, f->arr);
+                        } else {
+                            free_box(f->box);
+                            f->box = f->arr;
+                        }
+                    }
+                    else if (f->held)
+                        object_put(f->box, f->hkey, MINIBOX_MEMORY_RELEASE, &f->hval, f->held);
+                    
+                    f->held = 0;
                 }
-                array_add_box(__box,
-                              MINIBOX_MEMORY_RELEASE, box);
-                break;
                 
-            case XML_CLOSE:
-            case XML_LABEL:
-                break;
+                f->key = NULL;
                 
-            default:
-                ERROR(XML_FORMAT_ERROR, "xml_array")
-                return -1;
-        }
-    } while (level <= __xml->level);
-
-    return 0;
-}
-
-int xml_object(box_t __box, xml_t *__xml)
-{
-    int level = __xml->level;
-    char *key = NULL;
-    box_t box;
-    
-    do
-    {
-        if (xml_next(__xml)) return -1;
-        
-        switch (__xml->token.type)
-        {
-            case XML_VALUE:
-                switch (xml_value_type(&__xml->token))
+                if (!f->arr && !(f->key = xml_copy_key(t)))
                 {
-                    case MINIBOX_TYPE_NUMBER: {
-                        double value = atof(__xml->token.src);
-                        object_put_number(__box,
-                                          MINIBOX_MEMORY_RELEASE, key,
-                                          value);
-                    }   break;
-                    case MINIBOX_TYPE_STRING: {
-                        char *str = xml_copy_key(&__xml->token);
-                        object_put_string(__box,
-                                          MINIBOX_MEMORY_RELEASE, key,
-                                          MINIBOX_MEMORY_RELEASE, str);
-                    }   break;
-                    case MINIBOX_TRUE:
-                        object_put_boolean(__box,
-                                           MINIBOX_MEMORY_RELEASE, key,
-                                           1);
-                        break;
-                    case MINIBOX_FALSE:
-                        object_put_boolean(__box,
-                                           MINIBOX_MEMORY_RELEASE, key,
-                                           0);
-                        break;
-                    case MINIBOX_TYPE_NULL:
-                        object_put_null(__box,
-                                        MINIBOX_MEMORY_RELEASE, key);
-                        break;
-                    default: break;
+                    ERROR(BOX_MEMORY_ERROR, "xml_children")
+                    goto done;
                 }
-                break;
                 
-            case XML_ATTRIBUTE_OPEN:
-            
-                EIF(!(key = xml_copy_key(&__xml->token)),
-                    BOX_MEMORY_ERROR, "xml_object")
+                if (t->type == XML_LABEL)
+                    break;
                 
-                if (xml_is_array(__xml))
+                if (!(box = new_object()))
                 {
-                    box_t arr;
-                    char *ak;
-                    EIF(!(ak = xml_array_key(__xml)),
-                        XML_FORMAT_ERROR, "xml_object")
-                    EIF(!(box = new_object()),
-                        BOX_CREATE_ERROR, "xml_object")
-                    EIF(xml_attributes(box, __xml),
-                        XML_FORMAT_ERROR, "xml_object")
-                    EIF(!(arr = new_array()),
-                        BOX_CREATE_ERROR, "xml_object")
-                    EIF(xml_array(arr, __xml),
-                        XML_FORMAT_ERROR, "xml_object")
-                    
-                    object_put_box(box,
-                                   MINIBOX_MEMORY_RELEASE, ak,
-                                   MINIBOX_MEMORY_RELEASE, arr);
-                    
-                } else {
-                    
-                    EIF(!(box = new_object()),
-                        BOX_CREATE_ERROR, "xml_object")
-                    EIF(xml_attributes(box, __xml),
-                        XML_FORMAT_ERROR, "xml_object")
-                    EIF(xml_object(box, __xml),
-                        XML_FORMAT_ERROR, "xml_object")
+                    ERROR(BOX_CREATE_ERROR, "xml_children")
+                    goto done;
                 }
-                object_put_box(__box,
-                               MINIBOX_MEMORY_RELEASE, key,
-                               MINIBOX_MEMORY_RELEASE, box);
-                break;
                 
-            case XML_ATTRIBUTE_CLOSE:
+                type = t->type;
+                __xml->path = f->path && !sub->leaf ? sub : NULL;
                 
-                EIF(!(key = xml_copy_key(&__xml->token)),
-                    BOX_MEMORY_ERROR, "xml_object")
-                EIF(!(box = new_object()),
-                    BOX_CREATE_ERROR, "xml_object")
-                EIF(xml_attributes(box, __xml),
-                    XML_FORMAT_ERROR, "xml_object")
+                if (type != XML_OBJECT && xml_attributes(box, __xml))
+                {
+                    ERROR(XML_FORMAT_ERROR, "xml_children")
+                    free_box(box);
+                    goto done;
+                }
                 
-                object_put_box(__box,
-                               MINIBOX_MEMORY_RELEASE, key,
-                               MINIBOX_MEMORY_RELEASE, box);
-                break;
+                if (type == XML_ATTRIBUTE_CLOSE)
+                {
+                    __xml->path = f->path;
+                    xml_child(f, box);
+                    break;
+                }
                 
-            case XML_OBJECT:
-            
-                EIF(!(key = xml_copy_key(&__xml->token)),
-                    BOX_MEMORY_ERROR, "xml_object")
+                if (depth == __xml->depth)
+                {
+                    ERROR(BOX_DEPTH_ERROR, "xml_children")
+                    free_box(box);
+                    goto done;
+                }
                 
-                if (xml_is_array(__xml))
+                if (depth == max)
                 {
-                    EIF(!(box = new_array()),
-                        BOX_CREATE_ERROR, "xml_object")
-                    EIF(xml_array(box, __xml),
-                        XML_FORMAT_ERROR, "xml_object")
+                    if (!(tmp = malloc(max * 2 * sizeof(xml_frame_t))))
+                    {
+                        ERROR(BOX_MEMORY_ERROR, "xml_children")
+                        free_box(box);
+                        goto done;
+                    }
                     
-                } else {
-                    EIF(!(box = new_object()),
-                        BOX_CREATE_ERROR, "xml_object")
-                    EIF(xml_object(box, __xml),
-                        XML_FORMAT_ERROR, "xml_object")
+                    memcpy(tmp, stack, max * sizeof(xml_frame_t));
+                    if (stack != frames) free(stack);
+                    
+                    stack = tmp;
+                    max *= 2;
                 }
-                object_put_box(__box,
-                               MINIBOX_MEMORY_RELEASE, key,
-                               MINIBOX_MEMORY_RELEASE, box);
-                break;
                 
-            case XML_LABEL:
-                
-                key = xml_copy_key(&__xml->token);
-                break;
+                f = stack + depth++;
+                xml_frame(f, box, __xml, type == XML_ATTRIBUTE_OPEN);
+                continue;
                 
             case XML_CLOSE:
                 
-                key = NULL;
+                f->key = NULL;
                 break;
                 
             default:
                 
-                ERROR(XML_FORMAT_ERROR, "xml_object")
-                return -1;
+                ERROR(XML_FORMAT_ERROR, "xml_children")
+                goto done;
         }
-    } while (level <= __xml->level);
+        
+        while (__xml->level < f->level)
+        {
+            if (f->held)
+                object_put(f->box, f->hkey, MINIBOX_MEMORY_RELEASE, &f->hval, f->held);
+            
+            if (!--depth)
+            {
+                *__box = f->box;
+                r = 0;
+                goto done;
+            }
+            
+            box = f->box;
+            f = stack + depth - 1;
+            __xml->path = f->path;
+            
+            xml_child(f, box);
+        }
+    }
     
-    return 0;
+done:
+    while (r && depth--)
+    {
+        xml_drop(stack + depth);
+        if (depth) free_box(stack[depth].box);
+    }
+    
+    if (stack != frames) free(stack);
+    
+    return r;
 }
 
-const char* xml_parse_start(box_t __box, const char *__src)
+const char* xml_parse_start(box_t __box, const char *__src, const path_t *__path)
 {
-    xml_t xml = { __src, __src, 0, { 0, 0, 0, 0 } };
+    xml_t xml = { __src, __src, 0, { 0, 0, 0 }, __path, depth_current() };
     
     if (xml_next(&xml)) return NULL;
     
     if (xml.token.type == XML_ATTRIBUTE_OPEN)
         if (xml_attributes(__box, &xml)) return NULL;
     
-    if (xml_is_array(&xml)) {
-        char *key = xml_array_key(&xml);
-        box_t arr = new_array();
-        if (xml_array(arr, &xml)) return NULL;
-        object_put_box(__box,
-                       MINIBOX_MEMORY_RELEASE, key,
-                       MINIBOX_MEMORY_RELEASE, arr);
-    } else {
-        if (xml_object(__box, &xml)) return NULL;
-    }
+    if (xml_children(&__box, &xml, 1)) return NULL;
     
     return xml.ptr;
 }
@@ -764,69 +963,574 @@ const char* xml_parse_doctype(const char *__src)
     return strchr(__src, '>') + 1;
 }
 
-static void xml_put_value(box_t __str, long __type, const void *__value, int *__level)
+#pragma mark - Reader
+
+#define XML_EVENT(f, ...) (__rd->events->f ? __rd->events->f(__rd->ctx, ##__VA_ARGS__) : 0)
+
+/*
+ * The reader keeps in its buffer only the bytes of the token that was
+ * cut by the end of the last chunk; complete tokens are reported straight
+ * from the chunk. seen counts the pending bytes already searched for the
+ * end of that token, so long texts or comments are not rescanned.
+ * Texts and attribute values with references are decoded into text,
+ * which is kept between events.
+ */
+typedef struct
 {
-    switch (__type) {
-        case MINIBOX_TYPE_STRING:
-        case MINIBOX_TPAR_STRING:
-            stream_add(__str, *((char **) __value));
-            break;
+    const xml_events_t *events;
+    void *ctx;
+    char *text;
+    long size;
+    long level;
+    long seen;
+} xml_reader_t;
+
+box_t new_xml_reader(const xml_events_t *__events, void *__ctx)
+{
+    box_t arena = arena_use(0);
+    box_t __box = box_create(MINIBOX_TYPE_READER);
+    xml_reader_t *rd = NULL;
+    
+    arena_use(arena);
+    
+    if (!__box || !(rd = malloc(sizeof(xml_reader_t))))
+    {
+        ERROR(BOX_CREATE_ERROR, "new_xml_reader()")
+        if (__box) free_box(__box);
+        return 0;
+    }
+    
+    rd->events = __events;
+    rd->ctx = __ctx;
+    rd->text = NULL;
+    rd->size = 0;
+    rd->level = 0;
+    rd->seen = 0;
+    
+    ((long *) __box)[5] = (long) rd;
+    
+    return __box;
+}
+
+void xml_reader_release(box_t __box)
+{
+    xml_reader_t *rd = (xml_reader_t *) BOXH;
+    
+    free(rd->text);
+    free(rd);
+}
+
+static const char* xml_find(const char *__src, long __len, long __from, const char *__end)
+{
+    long n = strlen(__end);
+    
+    if (__from > n) __from -= n; else __from = 0;
+    
+    return memmem(__src + __from, __len - __from, __end, n);
+}
+
+/*
+ * Length of the markup at __src (a '<') up to its closing '>', or 0 when
+ * it does not end inside the buffer yet.
+ */
+static long xml_markup_end(const char *__src, long __len, long __seen)
+{
+    const char *p, *end = __src + __len;
+    long depth = 0;
+    char q = 0;
+    
+    if (__len < 2) return 0;
+    
+    switch (__src[1])
+    {
+        case '?':
+            p = xml_find(__src, __len, __seen > 2 ? __seen : 2, "?>");
+            return p ? p - __src + 2 : 0;
             
-        case MINIBOX_TYPE_ARRAY:
-        case MINIBOX_TPAR_ARRAY:
-            array_xml(*(box_t *)__value, __str, __level);
-            break;
+        case '!':
+            if (__len < 4) return 0;
             
-        case MINIBOX_TYPE_OBJECT:
-        case MINIBOX_TPAR_OBJECT:
-            object_xml(*(box_t *)__value, __str, __level);
+            if (!memcmp(__src, "<!--", 4))
+            {
+                p = xml_find(__src, __len, __seen > 4 ? __seen : 4, "-->");
+                return p ? p - __src + 3 : 0;
+            }
+            
+            if (__len < 9) return 0;
+            
+            if (!memcmp(__src, "<![CDATA[", 9))
+            {
+                p = xml_find(__src, __len, __seen > 9 ? __seen : 9, "]]>");
+                return p ? p - __src + 3 : 0;
+            }
             break;
             
-        default: box_put_value(__str, __type, __value, __level);
+        default: break;
+    }
+    
+    for (p = __src + 1; p < end; p++)
+    {
+        if (q) { if (*p == q) q = 0; continue; }
+        
+        switch (*p)
+        {
+            case '"': case '\'': q = *p; break;
+            case '[': depth++; break;
+            case ']': depth--; break;
+            case '>': if (depth <= 0) return p - __src + 1; break;
+            default: break;
+        }
+    }
+    
+    return 0;
+}
+
+/*
+ * Points *__src to a decoded copy of its __len bytes when they hold an
+ * '&', as the tree parser does with xml_unescape. CDATA is not decoded.
+ */
+static int xml_reader_unescape(xml_reader_t *__rd, const char **__src, long *__len)
+{
+    char *text;
+    
+    if (!memchr(*__src, '&', *__len)) return 0;
+    
+    if (*__len > __rd->size)
+    {
+        EIF(!(text = realloc(__rd->text, *__len)),
+            BOX_MEMORY_ERROR, "xml_reader_unescape()")
+        
+        __rd->text = text;
+        __rd->size = *__len;
+    }
+    
+    *__len = xml_unescape(__rd->text, *__src, *__len);
+    *__src = __rd->text;
+    
+    return 0;
+}
+
+static int xml_reader_text(xml_reader_t *__rd, const char *__src, long __len)
+{
+    const char *e = __src + __len;
+    
+    while (__src < e && IS_TRIM(*__src)) __src++;
+    while (e > __src && IS_TRIM(e[-1])) e--;
+    
+    if (__src == e) return 0;
+    
+    EIF(!__rd->level, XML_FORMAT_ERROR, "xml_reader_text()")
+    
+    __len = e - __src;
+    
+    if (xml_reader_unescape(__rd, &__src, &__len))
+        return -1;
+    
+    return XML_EVENT(text, __src, __len);
+}
+
+static int xml_reader_attributes(xml_reader_t *__rd, const char *__src, const char *__end)
+{
+    const char *key, *val;
+    long len, size;
+    char q;
+    int r;
+    
+    while (1)
+    {
+        while (__src < __end && IS_TRIM(*__src)) __src++;
+        
+        if (__src == __end) return 0;
+        
+        key = __src;
+        while (__src < __end && *__src != '=' && !IS_TRIM(*__src)) __src++;
+        len = __src - key;
+        
+        while (__src < __end && IS_TRIM(*__src)) __src++;
+        
+        EIF(__src == __end || *__src++ != '=',
+            XML_FORMAT_ERROR, "xml_reader_attributes()")
+        
+        while (__src < __end && IS_TRIM(*__src)) __src++;
+        
+        EIF(__src == __end || (*__src != '"' && *__src != '\''),
+            XML_FORMAT_ERROR, "xml_reader_attributes()")
+        
+        q = *__src++;
+        val = __src;
+        
+        EIF(!(__src = memchr(__src, q, __end - __src)),
+            XML_FORMAT_ERROR, "xml_reader_attributes()")
+        
+        size = __src++ - val;
+        
+        if (xml_reader_unescape(__rd, &val, &size))
+            return -1;
+        
+        if ((r = XML_EVENT(attribute, key, len, val, size)))
+            return r;
+    }
+}
+
+/*
+ * Classifies one complete markup with the same token types the tree
+ * parser uses and reports it: XML_CLOSE for end tags, XML_OBJECT for
+ * plain start tags, XML_ATTRIBUTE_OPEN/CLOSE for start tags carrying
+ * attributes or closing themselves and XML_VALUE for CDATA sections.
+ */
+static int xml_reader_markup(xml_reader_t *__rd, const char *__src, long __len)
+{
+    const char *p = __src + 1, *end = __src + __len - 1, *name;
+    int type = XML_OBJECT;
+    long len;
+    int r;
+    
+    if (*p == '?' || (*p == '!' && memcmp(p, "![CDATA[", 8)))
+        return 0;
+    
+    if (*p == '!')
+        type = XML_VALUE;
+    else if (*p == '/')
+        type = XML_CLOSE, p++;
+    else if (end[-1] == '/')
+        type = XML_ATTRIBUTE_CLOSE, end--;
+    
+    name = p;
+    while (p < end && *p != '/' && !IS_TRIM(*p)) p++;
+    len = p - name;
+    
+    while (p < end && IS_TRIM(*p)) p++;
+    
+    if (type == XML_OBJECT && p < end)
+        type = XML_ATTRIBUTE_OPEN;
+    
+    switch (type)
+    {
+        case XML_VALUE:
+            
+            EIF(!__rd->level, XML_FORMAT_ERROR, "xml_reader_markup()")
+            return XML_EVENT(text, __src + 9, __len - 12);
+            
+        case XML_CLOSE:
+            
+            EIF(!__rd->level--, XML_FORMAT_ERROR, "xml_reader_markup()")
+            return XML_EVENT(end_element, name, len);
+            
+        default:
+            
+            EIF(!len, XML_FORMAT_ERROR, "xml_reader_markup()")
+            
+            __rd->level++;
+            
+            if ((r = XML_EVENT(start_element, name, len)))
+                return r;
+            
+            if (type != XML_OBJECT && (r = xml_reader_attributes(__rd, p, end)))
+                return r;
+            
+            if (type != XML_ATTRIBUTE_CLOSE)
+                return 0;
+            
+            __rd->level--;
+            return XML_EVENT(end_element, name, len);
+    }
+}
+
+static long xml_reader_run(xml_reader_t *__rd, const char *__src, long __len, int *__r)
+{
+    const char *p, *e;
+    long pos = 0, n, seen = __rd->seen;
+    
+    *__r = 0;
+    __rd->seen = 0;
+    
+    while (pos < __len && !*__r)
+    {
+        p = __src + pos;
+        
+        if (*p != '<')
+        {
+            if (!(e = memchr(p + seen, '<', __len - pos - seen)))
+                break;
+            
+            *__r = xml_reader_text(__rd, p, e - p);
+            pos = e - __src;
+        }
+        else
+        {
+            if (!(n = xml_markup_end(p, __len - pos, seen)))
+                break;
+            
+            *__r = xml_reader_markup(__rd, p, n);
+            pos += n;
+        }
+        
+        seen = 0;
+    }
+    
+    if (!*__r) __rd->seen = __len - pos;
+    
+    return pos;
+}
+
+int xml_reader_feed(box_t __box, const char *__chunk, long __len)
+{
+    xml_reader_t *rd = (xml_reader_t *) BOXH;
+    const char *src = __chunk;
+    long len = __len, used;
+    int r;
+    
+    if (BOXS)
+    {
+        EIF(box_reallocated(__box, __len),
+            BOX_MEMORY_ERROR, "xml_reader_feed()")
+        
+        memcpy(BOXB + BOXS - __len, __chunk, __len);
+        src = BOXB;
+        len = BOXS;
     }
+    
+    used = xml_reader_run(rd, src, len, &r);
+    
+    if (src == __chunk)
+    {
+        EIF(box_reallocated(__box, len - used),
+            BOX_MEMORY_ERROR, "xml_reader_feed()")
+        
+        memcpy(BOXB, src + used, len - used);
+    }
+    else
+    {
+        memmove(BOXB, BOXB + used, len - used);
+        ((long *) __box)[1] = len - used;
+    }
+    
+    return r;
 }
 
-void array_xml(box_t __box, box_t __str, int *__level)
+int xml_reader_finish(box_t __box)
 {
+    xml_reader_t *rd = (xml_reader_t *) BOXH;
+    const char *p = BOXB, *e = p + BOXS;
+    
+    while (p < e && IS_TRIM(*p)) p++;
+    
+    EIF(p != e || rd->level, XML_FORMAT_ERROR, "xml_reader_finish()")
+    
+    return 0;
+}
+
+int xml_parse_events(const char *__src, const xml_events_t *__events, void *__ctx)
+{
+    box_t reader;
+    int r;
+    
+    if (!(reader = new_xml_reader(__events, __ctx)))
+        return -1;
+    
+    if (!(r = xml_reader_feed(reader, __src, strlen(__src))))
+        r = xml_reader_finish(reader);
+    
+    free_box(reader);
+    
+    return r;
+}
+
+int xml_parse_file_events(const char *__path, const xml_events_t *__events, void *__ctx)
+{
+    box_t reader;
+    FILE *file;
+    char *buf;
+    size_t len;
+    int r = 0;
+    
+    EIF(!(file = fopen(__path, "r")),
+        BOX_CREATE_ERROR, "xml_parse_file_events()")
+    
+    if (!(buf = malloc(XML_CHUNK)) || !(reader = new_xml_reader(__events, __ctx)))
+    {
+        ERROR(BOX_MEMORY_ERROR, "xml_parse_file_events()")
+        free(buf);
+        fclose(file);
+        return -1;
+    }
+    
+    while (!r && (len = fread(buf, 1, XML_CHUNK, file)))
+        r = xml_reader_feed(reader, buf, len);
+    
+    if (!r) r = ferror(file) ? -1 : xml_reader_finish(reader);
+    
+    free_box(reader);
+    free(buf);
+    fclose(file);
+    
+    return r;
+}
+
+#pragma mark - Serialize
+
+static void xml_put_string(box_t __str, value_t __value)
+{
+    stream_add_xml_text(__str, VALUE_STRING(__value), -1);
+}
+
+/*
+ * Like the JSON writers, the XML writers keep their frames, a container
+ * and the offset of its next slot, on an explicit stack. The close tag of
+ * an element holding a container is written when its frame is popped.
+ */
+typedef struct
+{
+    char *slots;
+    long size;
     long i;
-    *__level += 1;
+    int object;
+} xml_out_t;
+
+typedef struct
+{
+    xml_out_t *frame;
+    long count;
+    long size;
+} xml_writer_t;
+
+static xml_out_t* xml_out_push(xml_writer_t *__w, box_t __box)
+{
+    xml_out_t *f;
+    
+    if (__w->count == __w->size)
+    {
+        if (!(f = malloc(__w->size * 2 * sizeof(xml_out_t))))
+        {
+            ERROR(BOX_MEMORY_ERROR, "xml_out_push()")
+            return NULL;
+        }
+        
+        memcpy(f, __w->frame, __w->count * sizeof(xml_out_t));
+        if (__w->size > BOX_FRAMES) free(__w->frame);
+        
+        __w->frame = f;
+        __w->size *= 2;
+    }
+    
+    BOX_LOAD(__box);
+    
+    f = __w->frame + __w->count++;
+    f->slots = BOXB;
+    f->size = BOXS;
+    f->i = 0;
+    f->object = (BOXT | MINIBOX_MEMORY_RELEASE) == MINIBOX_TPAR_OBJECT;
+    
+    return f;
+}
+
+/*
+ * Writes the open or close tag of the slot before __f->i.
+ */
+static void xml_tag(box_t __str, xml_out_t *__f, int __close)
+{
+    char *key;
+    long len;
     
-    for (i = 0; i < BOXS; i += V2S)
+    if (!__f->object)
     {
-        void *value = BOXB + i + MINIBOX_VALUE;
-        long type  = *(long*) (BOXB + i + MINIBOX_TYPE);
-        stream_paragraph(__str, *__level);
-        stream_add(__str, "<item>");
-        xml_put_value(__str, type, value, __level);
-        stream_add(__str, "</item>");
+        stream_add(__str, __close ? "</item>" : "<item>");
+        return;
     }
     
-    *__level -= 1;
-    stream_paragraph(__str, *__level);
+    key = *(char **) (__f->slots + __f->i - V2S + MINIBOX_KEY);
+    len = KEY_SIZE(key);
+    
+    stream_add(__str, __close ? "</" : "<");
+    stream_add_length(__str, KEY_STR(key), len);
+    stream_add_char(__str, '>');
+}
+
+/*
+ * Writes the next slot of __f with its tags, or only its open tag when
+ * it is a container, which is returned to descend into.
+ */
+static box_t xml_put_value(box_t __str, xml_out_t *__f, int *__level)
+{
+    value_t value = SLOT(__f->slots + __f->i + MINIBOX_VALUE);
+    
+    __f->i += __f->object ? V2S : V1S;
+    
+    xml_tag(__str, __f, 0);
+    
+    switch (VALUE_TYPE(value))
+    {
+        case MINIBOX_TYPE_STRING:
+        case MINIBOX_TPAR_STRING:
+        case MINIBOX_SHORT_STRING:
+            xml_put_string(__str, value);
+            break;
+            
+        case MINIBOX_TYPE_ARRAY:
+        case MINIBOX_TPAR_ARRAY:
+        case MINIBOX_TYPE_OBJECT:
+        case MINIBOX_TPAR_OBJECT:
+            return (box_t) VALUE_PTR(value);
+            
+        default: box_put_value(__str, value, __level);
+    }
+    
+    xml_tag(__str, __f, 1);
+    
+    return 0;
 }
 
 void object_xml(box_t __box, box_t __str, int *__level)
 {
-    long i, s = BOXS;
-    *__level += 1;
+    xml_out_t frames[BOX_FRAMES], *f;
+    xml_writer_t w = { frames, 0, BOX_FRAMES };
     
-    for (i = 0; i < s; i += V3S)
+    while (__box && (f = xml_out_push(&w, __box)))
     {
-        void *value = (BOXB + i + MINIBOX_VALUE);
-        long type  = *(long *) (BOXB + i + MINIBOX_TYPE );
-        char *key = *(char **) (BOXB + i + MINIBOX_KEY  );
+        *__level += 1;
         
-        stream_paragraph(__str, *__level);
-        stream_add_char(__str, '<');
-        stream_add(__str, key);
-        stream_add_char(__str, '>');
-        xml_put_value(__str, type, value, __level);
-        stream_add(__str, "</");
-        stream_add(__str, key);
-        stream_add_char(__str, '>');
+        for (__box = 0; !__box && w.count; )
+        {
+            f = w.frame + w.count - 1;
+            
+            if (f->i == f->size)
+            {
+                stream_paragraph(__str, (*__level -= 1));
+                
+                if (--w.count) xml_tag(__str, f - 1, 1);
+                continue;
+            }
+            
+            stream_paragraph(__str, *__level);
+            __box = xml_put_value(__str, f, __level);
+        }
     }
-    *__level -= 1;
-    stream_paragraph(__str, *__level);
+    
+    if (w.size > BOX_FRAMES) free(w.frame);
 }
 
+#pragma mark - Compact
 
+void object_xml_compact(box_t __box, box_t __str)
+{
+    xml_out_t frames[BOX_FRAMES], *f;
+    xml_writer_t w = { frames, 0, BOX_FRAMES };
+    
+    while (__box && xml_out_push(&w, __box))
+    {
+        for (__box = 0; !__box && w.count; )
+        {
+            f = w.frame + w.count - 1;
+            
+            if (f->i == f->size)
+            {
+                if (--w.count) xml_tag(__str, f - 1, 1);
+                continue;
+            }
+            
+            __box = xml_put_value(__str, f, NULL);
+        }
+    }
+    
+    if (w.size > BOX_FRAMES) free(w.frame);
+}